@@ -0,0 +1,306 @@
+#include "async_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "capture.h"
+
+AsyncFileWriter::AsyncFileWriter()
+	: fd(-1), directIo(false), direct(false), fileBytes(0), file(0), pendingPaths(NULL), pendingFile(0), bufferSize(0),
+	submitted(0), submittedBytes(0),
+	droppedBuffers(0), droppedBytes(0), highWater(0), writtenBuffers(0), writtenBytes(0), writeError(0)
+{
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+	char errbuf[CAPTURE_ERRBUF_SIZE];
+
+	if (pool.Current() != NULL)
+		Close(0, errbuf);
+	for (size_t b = 0; b < buffers.size(); b++)
+		free(buffers[b].data);
+	delete pendingPaths;
+}
+
+bool AsyncFileWriter::OpenFile(const char *path)
+{
+	filePath = path;
+	fileBytes = 0;
+	direct = false;
+	if (directIo)
+	{
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+		direct = (fd >= 0);
+	}
+	if (fd < 0)	//not asked for or EINVAL, e.g. on tmpfs
+		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 && writeError == 0)
+	{
+		errorPath = path;
+		writeError = errno;
+	}
+	return fd >= 0;
+}
+
+void AsyncFileWriter::CloseFile()
+{
+	if (fd < 0)
+		return;
+	if (direct && ftruncate(fd, (off_t)fileBytes) < 0 && writeError == 0)
+	{
+		errorPath = filePath;
+		writeError = errno;
+	}
+	if (close(fd) < 0 && writeError == 0)
+	{
+		errorPath = filePath;
+		writeError = errno;
+	}
+	fd = -1;
+}
+
+void AsyncFileWriter::NextFile()
+{
+	std::string *next;
+
+	CloseFile();
+	file++;
+	if (pendingPaths->Pop(next))	//cannot fail, Rotate pushes the path before anything of the file is submitted
+	{
+		OpenFile(next->c_str());
+		delete next;
+	}
+}
+
+bool AsyncFileWriter::Open(const char *path, bool directIo, char *errbuf, size_t bufferSize, size_t buffers)
+{
+	this->path = path;
+	this->directIo = directIo;
+	writeError = 0;
+	if (!OpenFile(path))
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path, strerror(writeError));
+		writeError = 0;
+		return false;
+	}
+	file = 0;
+	pendingFile = 0;
+	pendingPaths = new SpscQueue<std::string *>(ASYNC_WRITER_PENDING_FILES);
+
+	this->bufferSize = (bufferSize + ASYNC_WRITER_ALIGN - 1) / ASYNC_WRITER_ALIGN * ASYNC_WRITER_ALIGN;
+	for (size_t b = 0; b < buffers; b++)
+	{
+		void *data;
+		if (posix_memalign(&data, ASYNC_WRITER_ALIGN, this->bufferSize) != 0)
+		{
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: cannot allocate the write buffers", path);
+			close(fd);
+			fd = -1;
+			return false;
+		}
+		WriteBuffer buffer = { (char *)data, 0, 0 };
+		this->buffers.push_back(buffer);
+	}
+
+	/*the vector is not resized any more, the pool can point into it*/
+	std::vector<WriteBuffer *> items;
+	for (size_t b = 0; b < buffers; b++)
+		items.push_back(&this->buffers[b]);
+	pool.Start(items, [this](WriteBuffer &buffer) { Write(buffer); });
+	return true;
+}
+
+char *AsyncFileWriter::Buffer() const
+{
+	return (pool.Current() != NULL) ? pool.Current()->data : NULL;
+}
+
+bool AsyncFileWriter::Rotate(size_t len, const char *path)
+{
+	std::string *next = new std::string(path);
+
+	/*the path goes first: when the writer is too far behind nothing is submitted, a partly filled buffer in the
+	middle of a file would be padded with O_DIRECT*/
+	if (!pendingPaths->Push(next))
+	{
+		delete next;
+		return false;
+	}
+	Submit(len);
+	pendingFile++;
+	return true;
+}
+
+char *AsyncFileWriter::Submit(size_t len)
+{
+	return Submit(len, false);
+}
+
+char *AsyncFileWriter::Submit(size_t len, bool last)
+{
+	WriteBuffer *buffer = pool.Current();
+
+	if (len == 0)
+		return buffer->data;
+	submittedBytes += len;
+	buffer->len = len;
+	buffer->file = pendingFile;
+	if (!pool.Submit(last))
+	{
+		/*the disk is behind: drop this buffer rather than hold up the capture*/
+		droppedBuffers++;
+		droppedBytes += len;
+		return buffer->data;
+	}
+
+	submitted++;
+	uint64_t queued = submitted - writtenBuffers.load(std::memory_order_relaxed);
+	if (queued > highWater)
+		highWater = queued;
+	return pool.Current()->data;
+}
+
+void AsyncFileWriter::Write(WriteBuffer &buffer)
+{
+	/*the files whose buffers were all dropped are still created*/
+	while (file < buffer.file)
+		NextFile();
+
+	/*O_DIRECT only takes whole aligned blocks, the padding of the last buffer of a file is cut off when it is
+	closed*/
+	size_t len = buffer.len;
+	if (direct && len % ASYNC_WRITER_ALIGN != 0)
+	{
+		size_t padded = (len + ASYNC_WRITER_ALIGN - 1) / ASYNC_WRITER_ALIGN * ASYNC_WRITER_ALIGN;
+		memset(buffer.data + len, 0, padded - len);
+		len = padded;
+	}
+
+	const char *p = buffer.data;
+	while (len > 0 && writeError == 0 && fd >= 0)
+	{
+		ssize_t n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+		{
+			errorPath = filePath;
+			writeError = errno;
+			break;
+		}
+		p += n;
+		len -= n;
+	}
+	fileBytes += buffer.len;
+	writtenBytes += buffer.len;
+	writtenBuffers++;
+}
+
+bool AsyncFileWriter::Close(size_t len, char *errbuf)
+{
+	bool ok = true;
+
+	if (pool.Current() == NULL)
+		return true;
+
+	/*the end of the file is not dropped*/
+	Submit(len, true);
+	pool.Stop();
+	/*the writer thread is joined, its files are finished from here*/
+	while (file < pendingFile)
+		NextFile();
+	CloseFile();
+
+	if (writeError != 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", errorPath.c_str(), strerror(writeError));
+		ok = false;
+	}
+	return ok;
+}
+
+size_t AsyncFileWriter::BufferSize() const
+{
+	return bufferSize;
+}
+
+uint64_t AsyncFileWriter::SubmittedBytes() const
+{
+	return submittedBytes;
+}
+
+void AsyncFileWriter::PrintStats(FILE *out) const
+{
+	fprintf(out, "%s: %llu bytes in %llu buffers and %u files%s, %llu buffers (%llu bytes) dropped waiting for the disk, "
+		"at most %llu of %zu buffers queued\n", path.c_str(), (unsigned long long)writtenBytes.load(),
+		(unsigned long long)writtenBuffers.load(), pendingFile + 1, direct ? " with O_DIRECT" : "",
+		(unsigned long long)droppedBuffers,
+		(unsigned long long)droppedBytes, (unsigned long long)highWater, buffers.size());
+}
+
+AsyncStreamBuf::AsyncStreamBuf(AsyncFileWriter &writer)
+	: writer(writer)
+{
+	setp(writer.Buffer(), writer.Buffer() + writer.BufferSize());
+}
+
+AsyncStreamBuf::int_type AsyncStreamBuf::overflow(int_type c)
+{
+	char *next = writer.Submit(pptr() - pbase());
+	setp(next, next + writer.BufferSize());
+	if (traits_type::eq_int_type(c, traits_type::eof()))
+		return traits_type::not_eof(c);
+	*pptr() = traits_type::to_char_type(c);
+	pbump(1);
+	return c;
+}
+
+std::streamsize AsyncStreamBuf::xsputn(const char *s, std::streamsize n)
+{
+	std::streamsize left = n;
+
+	while (left > 0)
+	{
+		std::streamsize room = epptr() - pptr();
+		if (room == 0)
+		{
+			overflow(traits_type::eof());
+			continue;
+		}
+		std::streamsize chunk = (left < room) ? left : room;
+		memcpy(pptr(), s, chunk);
+		pbump((int)chunk);
+		s += chunk;
+		left -= chunk;
+	}
+	return n;
+}
+
+int AsyncStreamBuf::sync()
+{
+	return 0;
+}
+
+bool AsyncStreamBuf::Rotate(const char *path)
+{
+	/*when the writer cannot rotate the buffer is kept as it is and goes on filling*/
+	if (!writer.Rotate(pptr() - pbase(), path))
+		return false;
+	setp(writer.Buffer(), writer.Buffer() + writer.BufferSize());
+	return true;
+}
+
+uint64_t AsyncStreamBuf::Bytes() const
+{
+	return writer.SubmittedBytes() + (pptr() - pbase());
+}
+
+bool AsyncStreamBuf::Close(char *errbuf)
+{
+	bool ok = writer.Close(pptr() - pbase(), errbuf);
+	setp(NULL, NULL);
+	return ok;
+}
@@ -0,0 +1,129 @@
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include "buffer_pool.h"
+
+/*default buffer size and count, 32 MB in flight is a few seconds of text output of one sensor*/
+#define ASYNC_WRITER_BUFFER_SIZE (4 << 20)
+#define ASYNC_WRITER_BUFFERS 8
+/*buffers, sizes and file offsets are kept multiples of this for O_DIRECT*/
+#define ASYNC_WRITER_ALIGN 4096
+/*files Rotate can have started before the writer thread has got to them*/
+#define ASYNC_WRITER_PENDING_FILES 64
+
+/*Writes a file from its own thread so the capture never waits for the disk.
+The producer fills fixed size aligned buffers taken from a BufferPool and submits them whole; the writer thread
+writes each one with a single large write and returns it to the pool. when the disk falls so far behind that the pool
+is empty the producer does not wait: the buffer just filled is dropped and counted, and refilled. with O_DIRECT the page cache is bypassed, so a slow SD card cannot build up gigabytes
+of dirty pages that are flushed in one long stall; the last buffer of a file is padded to the alignment and the file
+cut back to its length when it is closed. Rotate moves the output on to a new file without waiting either, the writer
+thread closes the old one and creates the new one when it gets there.*/
+class AsyncFileWriter
+{
+public:
+	AsyncFileWriter();
+	~AsyncFileWriter();
+
+	/*creates the file and starts the writer thread. directIo falls back to buffered writes where the file system
+	does not support it. returns false and fills errbuf (CAPTURE_ERRBUF_SIZE bytes) on failure.*/
+	bool Open(const char *path, bool directIo, char *errbuf, size_t bufferSize = ASYNC_WRITER_BUFFER_SIZE,
+		size_t buffers = ASYNC_WRITER_BUFFERS);
+	/*producer side: the buffer to fill, BufferSize() bytes, NULL before Open*/
+	char *Buffer() const;
+	/*producer side: hands the first len bytes of Buffer() to the writer thread and returns the next buffer. with
+	O_DIRECT only the last buffer of a file, the one given to Rotate or Close, may be partly filled.*/
+	char *Submit(size_t len);
+	/*producer side: submits len bytes as the end of the current file, what is submitted after goes to a new file at
+	path. returns false, submits nothing and stays with the current file if the writer thread is
+	ASYNC_WRITER_PENDING_FILES behind.*/
+	bool Rotate(size_t len, const char *path);
+	/*submits len bytes of the current buffer, waits for the writer thread to write everything and closes the file.
+	returns false and fills errbuf if any write failed.*/
+	bool Close(size_t len, char *errbuf);
+
+	size_t BufferSize() const;
+	/*bytes handed to Submit so far, including the ones dropped*/
+	uint64_t SubmittedBytes() const;
+	/*prints the bytes written, the buffers dropped and the most buffers that were queued at once*/
+	void PrintStats(FILE *out) const;
+
+private:
+	/*a buffer of the pool and what the producer filled it with*/
+	struct WriteBuffer
+	{
+		char *data;
+		size_t len;
+		uint32_t file;	//number of the file it belongs to, counted by Rotate
+	};
+
+	/*Submit, with last set the buffer waits for the writer thread to free one instead of being dropped*/
+	char *Submit(size_t len, bool last);
+	/*writer side: writes a filled buffer to its file*/
+	void Write(WriteBuffer &buffer);
+	/*writer side (and Open): opens path with O_DIRECT if asked for and possible. false and writeError set on failure*/
+	bool OpenFile(const char *path);
+	/*writer side: cuts off the O_DIRECT padding and closes the file*/
+	void CloseFile();
+	/*writer side: closes the current file and opens the next one Rotate started*/
+	void NextFile();
+
+	int fd;
+	std::string path;	//of the first file
+	std::string filePath;	//of the file being written, owned by the writer thread
+	bool directIo;	//asked for O_DIRECT
+	bool direct;	//the current file is open with O_DIRECT
+	uint64_t fileBytes;	//written to the current file, without the padding
+	uint32_t file;	//number of the file being written, owned by the writer thread
+	SpscQueue<std::string *> *pendingPaths;	//started by Rotate, producer to writer
+	uint32_t pendingFile;	//number of the file Submit fills, owned by the producer
+	size_t bufferSize;
+	std::vector<WriteBuffer> buffers;	//owns the data of the buffers
+	BufferPool<WriteBuffer> pool;
+
+	/*producer statistics*/
+	uint64_t submitted;	//buffers handed to the writer
+	uint64_t submittedBytes;
+	uint64_t droppedBuffers;
+	uint64_t droppedBytes;
+	uint64_t highWater;	//most buffers waiting for the writer at once
+	/*writer statistics*/
+	std::atomic<uint64_t> writtenBuffers;
+	std::atomic<uint64_t> writtenBytes;	//bytes of data, without the O_DIRECT padding
+	std::atomic<int> writeError;	//errno of the first failed write, 0 if none
+	std::string errorPath;	//file of writeError
+
+	AsyncFileWriter(const AsyncFileWriter &);
+	AsyncFileWriter &operator=(const AsyncFileWriter &);
+};
+
+/*an ostream buffer that formats straight into the buffers of an AsyncFileWriter. flushes do not submit anything,
+only full buffers are, so std::endl and std::flush on the stream cost nothing.*/
+class AsyncStreamBuf : public std::streambuf
+{
+public:
+	/*the writer has to be open*/
+	explicit AsyncStreamBuf(AsyncFileWriter &writer);
+	/*closes the writer with what is left in the buffer*/
+	bool Close(char *errbuf);
+	/*ends the current file with what is in the buffer and goes on in a new file at path, see AsyncFileWriter::Rotate*/
+	bool Rotate(const char *path);
+	/*bytes put into the stream so far*/
+	uint64_t Bytes() const;
+
+protected:
+	int_type overflow(int_type c);
+	std::streamsize xsputn(const char *s, std::streamsize n);
+	int sync();
+
+private:
+	AsyncFileWriter &writer;
+};
+
+#endif
@@ -0,0 +1,145 @@
+#include "block_simd.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLOCK_SIMD_X86
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BLOCK_SIMD_NEON
+#endif
+
+#define BLOCK_RETURNS 32
+#define BLOCK_RETURN_BYTES (BLOCK_RETURNS * 3)
+
+static const char *kernelName = "scalar";
+
+static void DeinterleaveScalar(const unsigned char *returns, uint32_t *distance, uint8_t *reflectivity, uint32_t scale)
+{
+	for (int c = 0; c < BLOCK_RETURNS; c++, returns += 3)
+	{
+		distance[c] = (uint32_t)(returns[0] | (returns[1] << 8)) * scale;
+		reflectivity[c] = returns[2];
+	}
+}
+
+#ifdef BLOCK_SIMD_X86
+/*pshufb masks that pick four returns out of 16 loaded bytes: the distances widened to 32 bit lanes, and the
+reflectivities packed into the low four bytes. the shifted variants are for the last group of a block, which is
+loaded four bytes early so the load does not run past the end of the block.*/
+#define Z (char)0x80
+#define DISTANCE_MASK(o) o + 0, o + 1, Z, Z, o + 3, o + 4, Z, Z, o + 6, o + 7, Z, Z, o + 9, o + 10, Z, Z
+#define REFLECTIVITY_MASK(o) o + 2, o + 5, o + 8, o + 11, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z
+
+__attribute__((target("sse4.1")))
+static void DeinterleaveSse41(const unsigned char *returns, uint32_t *distance, uint8_t *reflectivity, uint32_t scale)
+{
+	const __m128i distanceMask = _mm_setr_epi8(DISTANCE_MASK(0));
+	const __m128i reflectivityMask = _mm_setr_epi8(REFLECTIVITY_MASK(0));
+	const __m128i scaleVec = _mm_set1_epi32((int)scale);
+
+	/*groups 0-6 of four returns (12 bytes each) can be loaded 16 bytes wide in place*/
+	for (int g = 0; g < 7; g++)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(returns + g * 12));
+		__m128i d = _mm_mullo_epi32(_mm_shuffle_epi8(v, distanceMask), scaleVec);
+		int r = _mm_cvtsi128_si32(_mm_shuffle_epi8(v, reflectivityMask));
+
+		_mm_storeu_si128((__m128i *)(distance + g * 4), d);
+		memcpy(reflectivity + g * 4, &r, sizeof(r));
+	}
+
+	/*group 7 is bytes 84-95, load 80-95 and skip the first four*/
+	__m128i v = _mm_loadu_si128((const __m128i *)(returns + BLOCK_RETURN_BYTES - 16));
+	__m128i d = _mm_mullo_epi32(_mm_shuffle_epi8(v, _mm_setr_epi8(DISTANCE_MASK(4))), scaleVec);
+	int r = _mm_cvtsi128_si32(_mm_shuffle_epi8(v, _mm_setr_epi8(REFLECTIVITY_MASK(4))));
+
+	_mm_storeu_si128((__m128i *)(distance + 28), d);
+	memcpy(reflectivity + 28, &r, sizeof(r));
+}
+
+__attribute__((target("avx2")))
+static void DeinterleaveAvx2(const unsigned char *returns, uint32_t *distance, uint8_t *reflectivity, uint32_t scale)
+{
+	/*pshufb works per 128 bit lane, so each lane holds one group of four returns and uses the same masks as SSE*/
+	const __m256i distanceMask = _mm256_setr_epi8(DISTANCE_MASK(0), DISTANCE_MASK(0));
+	const __m256i reflectivityMask = _mm256_setr_epi8(REFLECTIVITY_MASK(0), REFLECTIVITY_MASK(0));
+	const __m256i lastDistanceMask = _mm256_setr_epi8(DISTANCE_MASK(0), DISTANCE_MASK(4));
+	const __m256i lastReflectivityMask = _mm256_setr_epi8(REFLECTIVITY_MASK(0), REFLECTIVITY_MASK(4));
+	const __m256i scaleVec = _mm256_set1_epi32((int)scale);
+
+	for (int g = 0; g < 4; g++)
+	{
+		const unsigned char *src = returns + g * 24;
+		bool last = (g == 3);
+		__m128i lo = _mm_loadu_si128((const __m128i *)src);
+		/*the high lane of the last pair would read past the block, load it four bytes early instead*/
+		__m128i hi = _mm_loadu_si128((const __m128i *)(last ? src + 8 : src + 12));
+		__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+		__m256i d = _mm256_shuffle_epi8(v, last ? lastDistanceMask : distanceMask);
+		__m256i r = _mm256_shuffle_epi8(v, last ? lastReflectivityMask : reflectivityMask);
+		_mm256_storeu_si256((__m256i *)(distance + g * 8), _mm256_mullo_epi32(d, scaleVec));
+
+		int r0 = _mm256_extract_epi32(r, 0);
+		int r1 = _mm256_extract_epi32(r, 4);
+		memcpy(reflectivity + g * 8, &r0, sizeof(r0));
+		memcpy(reflectivity + g * 8 + 4, &r1, sizeof(r1));
+	}
+}
+
+#undef Z
+#undef DISTANCE_MASK
+#undef REFLECTIVITY_MASK
+#endif
+
+#ifdef BLOCK_SIMD_NEON
+static void DeinterleaveNeon(const unsigned char *returns, uint32_t *distance, uint8_t *reflectivity, uint32_t scale)
+{
+	/*vld3 splits 16 returns at once into their low distance bytes, high distance bytes and reflectivities*/
+	for (int h = 0; h < 2; h++)
+	{
+		uint8x16x3_t v = vld3q_u8(returns + h * 48);
+		uint16x8_t lo = vorrq_u16(vmovl_u8(vget_low_u8(v.val[0])), vshlq_n_u16(vmovl_u8(vget_low_u8(v.val[1])), 8));
+		uint16x8_t hi = vorrq_u16(vmovl_u8(vget_high_u8(v.val[0])), vshlq_n_u16(vmovl_u8(vget_high_u8(v.val[1])), 8));
+		uint32_t *out = distance + h * 16;
+
+		vst1q_u32(out, vmull_n_u16(vget_low_u16(lo), (uint16_t)scale));
+		vst1q_u32(out + 4, vmull_n_u16(vget_high_u16(lo), (uint16_t)scale));
+		vst1q_u32(out + 8, vmull_n_u16(vget_low_u16(hi), (uint16_t)scale));
+		vst1q_u32(out + 12, vmull_n_u16(vget_high_u16(hi), (uint16_t)scale));
+		vst1q_u8(reflectivity + h * 16, v.val[2]);
+	}
+}
+#endif
+
+static DeinterleaveFunc SelectDeinterleaveKernel()
+{
+#ifdef BLOCK_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		kernelName = "avx2";
+		return DeinterleaveAvx2;
+	}
+	if (__builtin_cpu_supports("sse4.1"))
+	{
+		kernelName = "sse4.1";
+		return DeinterleaveSse41;
+	}
+#endif
+#ifdef BLOCK_SIMD_NEON
+	/*NEON is part of the base ARMv8 instruction set, on 32 bit ARM we only get here when compiled with -mfpu=neon*/
+	kernelName = "neon";
+	return DeinterleaveNeon;
+#endif
+	return DeinterleaveScalar;
+}
+
+DeinterleaveFunc DeinterleaveBlock = SelectDeinterleaveKernel();
+
+const char *DeinterleaveKernelName()
+{
+	return kernelName;
+}
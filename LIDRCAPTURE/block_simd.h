@@ -0,0 +1,17 @@
+#ifndef BLOCK_SIMD_H
+#define BLOCK_SIMD_H
+
+#include <stdint.h>
+
+/*splits the 32 packed (uint16 little endian distance, uint8 reflectivity) returns of one block, 96 bytes starting
+at returns, into a distance array in millimeters (raw distance times scale) and a reflectivity array. reads exactly
+the 96 bytes of the block.*/
+typedef void (*DeinterleaveFunc)(const unsigned char *returns, uint32_t *distance, uint8_t *reflectivity, uint32_t scale);
+
+/*the fastest kernel the CPU supports (AVX2, SSE4.1, NEON or plain C), picked once at startup*/
+extern DeinterleaveFunc DeinterleaveBlock;
+
+/*name of the kernel DeinterleaveBlock points to, for the startup banner*/
+const char *DeinterleaveKernelName();
+
+#endif
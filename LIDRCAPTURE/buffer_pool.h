@@ -0,0 +1,135 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stddef.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+#include "spsc_queue.h"
+
+/*how long a consumer thread sleeps when it finds nothing to do*/
+#define CONSUMER_IDLE_MS 1
+
+/*body of a consumer thread: calls consume, which returns false when it found nothing to do, until it finds nothing
+after stop was set. stop is read before consume looks, so whatever the producer handed over before it set stop is still
+consumed.*/
+template <class Consume>
+void ConsumeUntilStopped(const std::atomic<bool> &stop, Consume consume)
+{
+	while (true)
+	{
+		bool stopped = stop.load(std::memory_order_acquire);
+		if (consume())
+			continue;
+		if (stopped)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(CONSUMER_IDLE_MS));
+	}
+}
+
+/*Preallocated items (buffers, chunks, frames) passed from a producer thread to a consumer thread the pool runs.
+the producer fills Current() and submits it; the consumer thread calls consume on every submitted item in order and
+gives it back. both directions go through lock-free queues and the producer never waits: when every item is still
+with the consumer Submit fails, and the producer drops what it filled and fills the same item again. only the last
+item, the one given to Submit when closing, waits for the consumer. the caller owns the items.*/
+template <class T>
+class BufferPool
+{
+public:
+	BufferPool()
+		: freeItems(NULL), filledItems(NULL), current(NULL), size(0), stopping(false)
+	{
+	}
+
+	~BufferPool()
+	{
+		Stop();
+		delete freeItems;
+		delete filledItems;
+	}
+
+	/*the first item goes to the producer and the rest are free. starts the consumer thread.*/
+	void Start(const std::vector<T *> &items, std::function<void(T &)> consume)
+	{
+		delete freeItems;
+		delete filledItems;
+		size = items.size();
+		freeItems = new SpscQueue<T *>(size);
+		filledItems = new SpscQueue<T *>(size);
+		for (size_t i = 1; i < size; i++)
+			freeItems->Push(items[i]);
+		current = items[0];
+		this->consume = consume;
+		stopping = false;
+		consumer = std::thread(&BufferPool::Run, this);
+	}
+
+	/*producer side: the item to fill, NULL before Start and after Stop*/
+	T *Current() const
+	{
+		return current;
+	}
+
+	/*producer side: hands Current() to the consumer and makes the next free item current. returns false and keeps
+	Current() when the consumer has all of them, the caller then drops what it filled. with last set it waits for the
+	consumer to give one back instead, for the end of the output.*/
+	bool Submit(bool last = false)
+	{
+		T *next;
+
+		while (!freeItems->Pop(next))
+		{
+			if (!last)
+				return false;
+			std::this_thread::sleep_for(std::chrono::milliseconds(CONSUMER_IDLE_MS));
+		}
+		filledItems->Push(current);	//cannot fail, the queue has room for every item
+		current = next;
+		return true;
+	}
+
+	/*producer side: lets the consumer finish everything submitted and joins it*/
+	void Stop()
+	{
+		if (!consumer.joinable())
+			return;
+		stopping = true;
+		consumer.join();
+		current = NULL;
+	}
+
+	/*items in the pool*/
+	size_t Size() const
+	{
+		return size;
+	}
+
+private:
+	void Run()
+	{
+		ConsumeUntilStopped(stopping, [this]()
+		{
+			T *item;
+			if (!filledItems->Pop(item))
+				return false;
+			consume(*item);
+			freeItems->Push(item);
+			return true;
+		});
+	}
+
+	SpscQueue<T *> *freeItems;	//consumer to producer
+	SpscQueue<T *> *filledItems;	//producer to consumer
+	T *current;
+	size_t size;
+	std::function<void(T &)> consume;
+	std::thread consumer;
+	std::atomic<bool> stopping;
+
+	BufferPool(const BufferPool &);
+	BufferPool &operator=(const BufferPool &);
+};
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef BYTE_ORDER_H
+#define BYTE_ORDER_H
+
+#include <stdint.h>
+
+/*integer loads from byte buffers. they only read through the pointer they are given, so they are safe to call from
+any number of threads, and compile down to a single (byte swapped) load on little endian machines.*/
+
+/*the sensor sends its fields little endian*/
+constexpr uint16_t LoadLE16(const unsigned char *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+constexpr uint32_t LoadLE32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*Ethernet, IP and UDP headers are big endian*/
+constexpr uint16_t LoadBE16(const unsigned char *p)
+{
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+#endif
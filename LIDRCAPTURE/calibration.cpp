@@ -0,0 +1,174 @@
+#include "calibration.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+/*distances at which the two point distance correction was measured, meters*/
+#define CORRECTION_NEAR_X 2.4
+#define CORRECTION_NEAR_Y 1.93
+#define CORRECTION_FAR 25.04
+#define CALIBRATION_LINE_LEN 1024
+
+void BuildCalibrationTable(const LaserCorrection *corrections, int lasers, CalibrationTable &table)
+{
+	for (int c = 0; c < CHANNELS_PER_BLOCK; c++)
+	{
+		const LaserCorrection &laser = corrections[c % lasers];
+
+		table.cosVert[c] = (float)cos(laser.vertCorrection);
+		table.sinVert[c] = (float)sin(laser.vertCorrection);
+		table.cosRot[c] = (float)cos(laser.rotCorrection);
+		table.sinRot[c] = (float)sin(laser.rotCorrection);
+		table.distCorrection[c] = (float)laser.distCorrection;
+		/*the kernel adds these to the already corrected distance, so they are relative to distCorrection*/
+		table.slopeX[c] = (float)((laser.distCorrection - laser.distCorrectionX) / (CORRECTION_FAR - CORRECTION_NEAR_X));
+		table.offsetX[c] = (float)(laser.distCorrectionX - laser.distCorrection - table.slopeX[c] * CORRECTION_NEAR_X);
+		table.slopeY[c] = (float)((laser.distCorrection - laser.distCorrectionY) / (CORRECTION_FAR - CORRECTION_NEAR_Y));
+		table.offsetY[c] = (float)(laser.distCorrectionY - laser.distCorrection - table.slopeY[c] * CORRECTION_NEAR_Y);
+		table.vertOffset[c] = (float)laser.vertOffset;
+		table.horizOffset[c] = (float)laser.horizOffset;
+	}
+	table.lasers = lasers;
+}
+
+/*one entry of the lasers: list while it is being read*/
+struct LaserEntry
+{
+	LaserCorrection correction;
+	int id;
+	bool hasDistCorrectionX;
+	bool hasDistCorrectionY;
+};
+
+static char *Trim(char *s)
+{
+	while (*s == ' ' || *s == '\t')
+		s++;
+	char *end = s + strlen(s);
+	while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n'))
+		*--end = '\0';
+	return s;
+}
+
+/*reads the "key: value" pairs of a line of a laser entry, separated by commas in flow style*/
+static void ParseLaserPairs(char *text, LaserEntry &entry)
+{
+	for (char *p = text; *p; p++)
+	{
+		if (*p == '{' || *p == '}')
+			*p = ' ';
+	}
+
+	char *save = NULL;
+	for (char *pair = strtok_r(text, ",", &save); pair != NULL; pair = strtok_r(NULL, ",", &save))
+	{
+		char *colon = strchr(pair, ':');
+		if (colon == NULL)
+			continue;
+		*colon = '\0';
+		const char *key = Trim(pair);
+		double value = strtod(colon + 1, NULL);
+
+		if (strcmp(key, "laser_id") == 0)
+			entry.id = (int)value;
+		else if (strcmp(key, "rot_correction") == 0)
+			entry.correction.rotCorrection = value;
+		else if (strcmp(key, "vert_correction") == 0)
+			entry.correction.vertCorrection = value;
+		else if (strcmp(key, "dist_correction") == 0)
+			entry.correction.distCorrection = value;
+		else if (strcmp(key, "dist_correction_x") == 0)
+		{
+			entry.correction.distCorrectionX = value;
+			entry.hasDistCorrectionX = true;
+		}
+		else if (strcmp(key, "dist_correction_y") == 0)
+		{
+			entry.correction.distCorrectionY = value;
+			entry.hasDistCorrectionY = true;
+		}
+		else if (strcmp(key, "vert_offset_correction") == 0)
+			entry.correction.vertOffset = value;
+		else if (strcmp(key, "horiz_offset_correction") == 0)
+			entry.correction.horizOffset = value;
+	}
+}
+
+bool LoadCalibration(const char *path, CalibrationTable &table, char *errbuf)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path, strerror(errno));
+		return false;
+	}
+
+	std::vector<LaserEntry> entries;
+	char line[CALIBRATION_LINE_LEN];
+	bool inLasers = false;
+	int numLasers = -1;
+
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		char *text = Trim(line);
+		if (*text == '\0' || *text == '#')
+			continue;
+
+		/*a key at the start of the line ends the lasers: list*/
+		if (text == line && *text != '-')
+		{
+			inLasers = (strncmp(text, "lasers:", 7) == 0);
+			if (strncmp(text, "num_lasers:", 11) == 0)
+				numLasers = atoi(text + 11);
+			continue;
+		}
+		if (!inLasers)
+			continue;
+
+		if (text[0] == '-' && (text[1] == ' ' || text[1] == '{'))
+		{
+			LaserEntry entry;
+			memset(&entry, 0, sizeof(entry));
+			entry.id = -1;
+			entries.push_back(entry);
+			text++;
+		}
+		if (!entries.empty())
+			ParseLaserPairs(text, entries.back());
+	}
+	fclose(file);
+
+	int lasers = (int)entries.size();
+	if (lasers == 0 || lasers > CHANNELS_PER_BLOCK || (numLasers != -1 && numLasers != lasers))
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %d lasers listed, num_lasers is %d", path, lasers, numLasers);
+		return false;
+	}
+
+	LaserCorrection corrections[CHANNELS_PER_BLOCK];
+	bool seen[CHANNELS_PER_BLOCK] = { false };
+	for (int e = 0; e < lasers; e++)
+	{
+		LaserEntry &entry = entries[e];
+		if (entry.id < 0 || entry.id >= lasers || seen[entry.id])
+		{
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: laser %d has a missing, duplicate or out of range laser_id",
+				path, e);
+			return false;
+		}
+		/*without the two point correction every distance gets the same offset*/
+		if (!entry.hasDistCorrectionX)
+			entry.correction.distCorrectionX = entry.correction.distCorrection;
+		if (!entry.hasDistCorrectionY)
+			entry.correction.distCorrectionY = entry.correction.distCorrection;
+		corrections[entry.id] = entry.correction;
+		seen[entry.id] = true;
+	}
+
+	BuildCalibrationTable(corrections, lasers, table);
+	return true;
+}
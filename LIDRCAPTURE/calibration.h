@@ -0,0 +1,48 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <stdint.h>
+#include "packet_decoder.h"
+
+/*the intrinsic corrections of one laser as the vendor calibration file gives them, radians and meters*/
+struct LaserCorrection
+{
+	double rotCorrection;	//azimuth offset of the laser
+	double vertCorrection;	//vertical angle of the laser
+	double distCorrection;	//added to every distance
+	double distCorrectionX;	//two point distance correction along x and y, equal to distCorrection when unused
+	double distCorrectionY;
+	double vertOffset;	//height of the laser above the optical center
+	double horizOffset;	//sideways offset of the laser from the optical center
+};
+
+/*the corrections of a sensor precomputed for the conversion kernel, one entry per return of a block (return c is
+laser c % lasers). every array is read straight through for the 32 returns, so the kernel needs no lookups and no
+branches to apply them. an uncalibrated sensor uses a table with the nominal vertical angles and no offsets, the
+kernel is the same either way.*/
+struct CalibrationTable
+{
+	alignas(16) float cosVert[CHANNELS_PER_BLOCK];
+	alignas(16) float sinVert[CHANNELS_PER_BLOCK];
+	alignas(16) float cosRot[CHANNELS_PER_BLOCK];
+	alignas(16) float sinRot[CHANNELS_PER_BLOCK];
+	alignas(16) float distCorrection[CHANNELS_PER_BLOCK];	//meters
+	/*the two point correction as a line through the corrections at 2.4 m (x) or 1.93 m (y) and 25.04 m*/
+	alignas(16) float slopeX[CHANNELS_PER_BLOCK];
+	alignas(16) float offsetX[CHANNELS_PER_BLOCK];
+	alignas(16) float slopeY[CHANNELS_PER_BLOCK];
+	alignas(16) float offsetY[CHANNELS_PER_BLOCK];
+	alignas(16) float vertOffset[CHANNELS_PER_BLOCK];
+	alignas(16) float horizOffset[CHANNELS_PER_BLOCK];
+	int lasers;	//number of lasers the table was built for
+};
+
+/*precomputes the corrections of lasers 0 to lasers - 1 into table*/
+void BuildCalibrationTable(const LaserCorrection *corrections, int lasers, CalibrationTable &table);
+
+/*loads a calibration file in the YAML format of the ROS velodyne driver (a lasers: list with one map per laser,
+flow or block style, and num_lasers) and precomputes it into table. returns false and fills errbuf
+(CAPTURE_ERRBUF_SIZE bytes) if the file cannot be read or does not describe every laser.*/
+bool LoadCalibration(const char *path, CalibrationTable &table, char *errbuf);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <atomic>
+
+/*size of the error buffers filled in by the capture backends (same as PCAP_ERRBUF_SIZE)*/
+#define CAPTURE_ERRBUF_SIZE 256
+
+/*UDP ports the sensor sends its data and position packets to*/
+#define VELODYNE_DATA_PORT 2368
+#define VELODYNE_POSITION_PORT 8308
+/*UDP payload length of the data and position packets*/
+#define VELODYNE_DATA_PAYLOAD_LEN 1206
+#define VELODYNE_POSITION_PAYLOAD_LEN 512
+/*longest a capture backend waits for packets before it looks at its stop flag again, in milliseconds*/
+#define CAPTURE_STOP_CHECK_MS 100
+/*capture length that holds a whole data packet frame: Ethernet (+ one VLAN tag), IPv4 without options, UDP, payload*/
+#define SENSOR_SNAPLEN (14 + 4 + 20 + 8 + VELODYNE_DATA_PAYLOAD_LEN)
+
+/*what the first byte of a captured packet is*/
+enum PacketLayer
+{
+	LAYER_ETHERNET,	//a whole link layer frame (pcap, packet ring)
+	LAYER_UDP_PAYLOAD	//only the UDP payload (socket receivers)
+};
+
+/*one captured packet as handed from a capture backend to the decoder. data points straight into the
+backend's buffer (the pcap buffer or the mapped ring) and is only valid for the duration of the handler call.*/
+struct RawPacket
+{
+	const unsigned char *data;	//first byte of the packet, see layer
+	unsigned int caplen;	//number of bytes available at data
+	unsigned int len;	//length of the packet on the wire
+	uint64_t timestampNs;	//capture time in nanoseconds since the epoch
+	PacketLayer layer;
+	unsigned short dstPort;	//UDP destination port, only known up front for LAYER_UDP_PAYLOAD (0 otherwise)
+	unsigned int sensor;	//index of the sensor the packet came from, 0 unless a backend serves several sensors
+};
+
+/*called by a capture backend for every packet it receives*/
+typedef void (*PacketHandler)(const RawPacket &packet, void *user);
+
+#endif
@@ -0,0 +1,263 @@
+#include "deskew.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#define POSE_LINE_LEN 512
+/*points are moved in batches of one block, the pose is only sampled exactly at the ends of each batch*/
+#define DESKEW_BATCH CHANNELS_PER_BLOCK
+/*a batch that spans more time than this (a gap in the packets) gets an exact pose for every point*/
+#define DESKEW_MAX_SPAN_NS 1000000
+
+bool PoseStream::Load(const char *path, char *errbuf)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path, strerror(errno));
+		return false;
+	}
+
+	char line[POSE_LINE_LEN];
+	int lineNumber = 0;
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		double seconds, v[7];
+		lineNumber++;
+
+		for (char *p = line; *p; p++)
+		{
+			if (*p == ',')
+				*p = ' ';
+		}
+		char *text = line + strspn(line, " \t");
+		if (*text == '#' || *text == '\n' || *text == '\r' || *text == '\0')
+			continue;
+		if (sscanf(text, "%lf %lf %lf %lf %lf %lf %lf %lf", &seconds, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5],
+			&v[6]) != 8)
+		{
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s:%d: expected time x y z qx qy qz qw", path, lineNumber);
+			fclose(file);
+			return false;
+		}
+
+		Pose pose;
+		double norm = sqrt(v[3] * v[3] + v[4] * v[4] + v[5] * v[5] + v[6] * v[6]);
+		pose.timeNs = (uint64_t)(seconds * 1e9 + 0.5);
+		pose.x = v[0];
+		pose.y = v[1];
+		pose.z = v[2];
+		pose.qx = v[3] / norm;
+		pose.qy = v[4] / norm;
+		pose.qz = v[5] / norm;
+		pose.qw = v[6] / norm;
+		if (!poses.empty() && pose.timeNs <= poses.back().timeNs)
+		{
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s:%d: poses are not in time order", path, lineNumber);
+			fclose(file);
+			return false;
+		}
+		poses.push_back(pose);
+	}
+	fclose(file);
+
+	if (poses.empty())
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: no poses", path);
+		return false;
+	}
+	return true;
+}
+
+void PoseStream::Add(const Pose &pose)
+{
+	poses.push_back(pose);
+}
+
+size_t PoseStream::Size() const
+{
+	return poses.size();
+}
+
+uint64_t PoseStream::StartNs() const
+{
+	return poses.front().timeNs;
+}
+
+uint64_t PoseStream::EndNs() const
+{
+	return poses.back().timeNs;
+}
+
+static bool PoseBefore(uint64_t timeNs, const Pose &pose)
+{
+	return timeNs < pose.timeNs;
+}
+
+bool PoseStream::Interpolate(uint64_t timeNs, Pose &pose) const
+{
+	if (poses.empty())
+		return false;
+
+	std::vector<Pose>::const_iterator next = std::upper_bound(poses.begin(), poses.end(), timeNs, PoseBefore);
+	if (next == poses.begin())
+	{
+		pose = poses.front();
+		return false;
+	}
+	if (next == poses.end())
+	{
+		pose = poses.back();
+		return timeNs == poses.back().timeNs;
+	}
+
+	const Pose &p0 = *(next - 1);
+	const Pose &p1 = *next;
+	double a = (double)(timeNs - p0.timeNs) / (double)(p1.timeNs - p0.timeNs);
+
+	pose.timeNs = timeNs;
+	pose.x = p0.x + a * (p1.x - p0.x);
+	pose.y = p0.y + a * (p1.y - p0.y);
+	pose.z = p0.z + a * (p1.z - p0.z);
+
+	/*SLERP along the shorter arc, plain normalized lerp where the two are so close that sin(theta) is tiny*/
+	double dot = p0.qw * p1.qw + p0.qx * p1.qx + p0.qy * p1.qy + p0.qz * p1.qz;
+	double sign = (dot < 0) ? -1 : 1;
+	double w0 = 1 - a, w1 = a;
+	dot *= sign;
+	if (dot < 0.9995)
+	{
+		double theta = acos(dot);
+		w0 = sin((1 - a) * theta) / sin(theta);
+		w1 = sin(a * theta) / sin(theta);
+	}
+	w1 *= sign;
+	pose.qw = w0 * p0.qw + w1 * p1.qw;
+	pose.qx = w0 * p0.qx + w1 * p1.qx;
+	pose.qy = w0 * p0.qy + w1 * p1.qy;
+	pose.qz = w0 * p0.qz + w1 * p1.qz;
+
+	double norm = sqrt(pose.qw * pose.qw + pose.qx * pose.qx + pose.qy * pose.qy + pose.qz * pose.qz);
+	pose.qw /= norm;
+	pose.qx /= norm;
+	pose.qy /= norm;
+	pose.qz /= norm;
+	return true;
+}
+
+/*row major rotation matrix of a unit quaternion*/
+static void RotationMatrix(const Pose &pose, double r[9])
+{
+	double w = pose.qw, x = pose.qx, y = pose.qy, z = pose.qz;
+
+	r[0] = 1 - 2 * (y * y + z * z);
+	r[1] = 2 * (x * y - w * z);
+	r[2] = 2 * (x * z + w * y);
+	r[3] = 2 * (x * y + w * z);
+	r[4] = 1 - 2 * (x * x + z * z);
+	r[5] = 2 * (y * z - w * x);
+	r[6] = 2 * (x * z - w * y);
+	r[7] = 2 * (y * z + w * x);
+	r[8] = 1 - 2 * (x * x + y * y);
+}
+
+/*the transform from the sensor frame at one time to the sensor frame at the end of the sweep, p' = r p + t*/
+struct RelativeTransform
+{
+	float r[9];
+	float t[3];
+};
+
+static void RelativeTo(const double endR[9], const Pose &end, const Pose &pose, RelativeTransform &out)
+{
+	double r[9];
+	double d[3] = { pose.x - end.x, pose.y - end.y, pose.z - end.z };
+
+	RotationMatrix(pose, r);
+	/*endR transposed times r, and endR transposed times the offset between the two positions*/
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+			out.r[3 * i + j] = (float)(endR[i] * r[j] + endR[3 + i] * r[3 + j] + endR[6 + i] * r[6 + j]);
+		out.t[i] = (float)(endR[i] * d[0] + endR[3 + i] * d[1] + endR[6 + i] * d[2]);
+	}
+}
+
+bool DeskewSweep(const PoseStream &poses, Sweep &sweep, size_t *unposed)
+{
+	Pose end;
+	double endR[9];
+	size_t outside = 0;
+
+	if (!poses.Interpolate(sweep.info.endNs, end))
+		return false;
+	RotationMatrix(end, endR);
+
+	const uint64_t firstNs = poses.StartNs();
+	float *x = &sweep.x[0];
+	float *y = &sweep.y[0];
+	float *z = &sweep.z[0];
+	const uint64_t *timeNs = &sweep.timeNs[0];
+
+	for (size_t start = 0; start < sweep.count; start += DESKEW_BATCH)
+	{
+		size_t n = std::min((size_t)DESKEW_BATCH, sweep.count - start);
+		uint64_t t0 = timeNs[start], t1 = timeNs[start];
+		Pose p0, p1;
+		RelativeTransform a, b;
+
+		/*a batch is one block or less, a tenth of a millisecond. the exact poses at its ends are SLERPed, in between
+		the transform is interpolated linearly, which is far below the noise of any pose source over that time.*/
+		for (size_t i = start; i < start + n; i++)
+		{
+			t0 = std::min(t0, timeNs[i]);
+			t1 = std::max(t1, timeNs[i]);
+			outside += (timeNs[i] < firstNs);
+		}
+		if (t1 - t0 > DESKEW_MAX_SPAN_NS)
+		{
+			for (size_t i = start; i < start + n; i++)
+			{
+				float px = x[i], py = y[i], pz = z[i];
+
+				poses.Interpolate(timeNs[i], p0);
+				RelativeTo(endR, end, p0, a);
+				x[i] = a.r[0] * px + a.r[1] * py + a.r[2] * pz + a.t[0];
+				y[i] = a.r[3] * px + a.r[4] * py + a.r[5] * pz + a.t[1];
+				z[i] = a.r[6] * px + a.r[7] * py + a.r[8] * pz + a.t[2];
+			}
+			continue;
+		}
+
+		poses.Interpolate(t0, p0);
+		poses.Interpolate(t1, p1);
+		RelativeTo(endR, end, p0, a);
+		RelativeTo(endR, end, p1, b);
+
+		float dr[9], dt[3];
+		for (int k = 0; k < 9; k++)
+			dr[k] = b.r[k] - a.r[k];
+		for (int k = 0; k < 3; k++)
+			dt[k] = b.t[k] - a.t[k];
+		float scale = (t1 > t0) ? 1.0f / (float)(t1 - t0) : 0.0f;
+
+		for (size_t i = start; i < start + n; i++)
+		{
+			float f = (float)(timeNs[i] - t0) * scale;
+			float px = x[i], py = y[i], pz = z[i];
+
+			x[i] = (a.r[0] + f * dr[0]) * px + (a.r[1] + f * dr[1]) * py + (a.r[2] + f * dr[2]) * pz + a.t[0] + f * dt[0];
+			y[i] = (a.r[3] + f * dr[3]) * px + (a.r[4] + f * dr[4]) * py + (a.r[5] + f * dr[5]) * pz + a.t[1] + f * dt[1];
+			z[i] = (a.r[6] + f * dr[6]) * px + (a.r[7] + f * dr[7]) * py + (a.r[8] + f * dr[8]) * pz + a.t[2] + f * dt[2];
+		}
+	}
+
+	sweep.info.deskewed = true;
+	if (unposed != NULL)
+		*unposed = outside;
+	return true;
+}
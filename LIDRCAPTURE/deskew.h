@@ -0,0 +1,49 @@
+#ifndef DESKEW_H
+#define DESKEW_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "sweep_assembler.h"
+
+/*where the sensor was at one point in time: its position and orientation in a fixed world frame. the rotation is a
+unit quaternion that takes sensor frame coordinates to world coordinates.*/
+struct Pose
+{
+	uint64_t timeNs;	//nanoseconds since the epoch, the same clock as the point times
+	double x, y, z;	//meters
+	double qw, qx, qy, qz;
+};
+
+/*a time ordered list of sensor poses, from the GPS/IMU solution or from odometry, that can be sampled at any time
+between the first and the last pose*/
+class PoseStream
+{
+public:
+	/*reads poses from a text file in the TUM trajectory format: one "time x y z qx qy qz qw" line per pose, time in
+	seconds since the epoch, fields separated by spaces or commas, # starts a comment. the poses must be of the lidar
+	frame, an IMU solution has to be moved by the lever arm and boresight first. returns false and fills errbuf
+	(CAPTURE_ERRBUF_SIZE bytes) if the file cannot be read or has no poses.*/
+	bool Load(const char *path, char *errbuf);
+	/*adds a pose at the end, it has to be newer than the last one*/
+	void Add(const Pose &pose);
+
+	/*pose at timeNs, linear in position and SLERP in orientation between the two poses around it. times outside the
+	stream get the first or last pose and make it return false.*/
+	bool Interpolate(uint64_t timeNs, Pose &pose) const;
+	size_t Size() const;
+	/*times of the first and last pose, only valid if Size() is not 0*/
+	uint64_t StartNs() const;
+	uint64_t EndNs() const;
+
+private:
+	std::vector<Pose> poses;
+};
+
+/*removes the motion of the sensor during a sweep: every point is moved from the sensor frame at its own time into
+the sensor frame at the end of the sweep. the sweep is changed in place and marked deskewed. returns false, and
+leaves the sweep as it is, if there is no pose for the end of the sweep. points taken before the first pose are
+moved as if they were taken at the first pose; their number is returned in unposed if it is not NULL.*/
+bool DeskewSweep(const PoseStream &poses, Sweep &sweep, size_t *unposed);
+
+#endif
@@ -0,0 +1,419 @@
+#include "las_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <chrono>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define LAS_HEADER_LEN 375
+#define LAS_POINT_FORMAT 6
+#define LAS_POINT_LEN 30
+/*global encoding: GPS time is adjusted standard GPS time, the CRS would be WKT (required for format 6)*/
+#define LAS_GLOBAL_ENCODING 0x11
+/*seconds from the Unix epoch to the GPS epoch (1980-01-06), and the shift of adjusted standard GPS time*/
+#define GPS_EPOCH_UNIX_SECONDS 315964800LL
+#define LAS_ADJUSTED_GPS_SHIFT 1000000000LL
+#define LAS_ZSTD_LEVEL 3
+
+/*a zstd frame holding the header uncompressed: magic, frame header with the content size, one raw block*/
+#define ZSTD_FRAME_MAGIC 0xFD2FB528
+#define ZSTD_RAW_FRAME_OVERHEAD (4 + 1 + 2 + 3)
+
+static void Put16(uint8_t *p, uint16_t v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+static void Put32(uint8_t *p, uint32_t v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+static void Put64(uint8_t *p, uint64_t v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+static void PutDouble(uint8_t *p, double v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+void LasWriter::Extent::Clear()
+{
+	points = 0;
+	pointsByReturn[0] = pointsByReturn[1] = 0;
+	for (int a = 0; a < 3; a++)
+	{
+		min[a] = DBL_MAX;
+		max[a] = -DBL_MAX;
+	}
+}
+
+void LasWriter::Extent::Add(const Extent &other)
+{
+	points += other.points;
+	pointsByReturn[0] += other.pointsByReturn[0];
+	pointsByReturn[1] += other.pointsByReturn[1];
+	for (int a = 0; a < 3; a++)
+	{
+		min[a] = fmin(min[a], other.min[a]);
+		max[a] = fmax(max[a], other.max[a]);
+	}
+}
+
+LasWriter::LasWriter()
+	: fd(-1), compression(LAS_UNCOMPRESSED), offset(0), haveOrigin(false), stopping(false), submitted(0),
+	collected(0)
+{
+	origin[0] = origin[1] = origin[2] = 0;
+	written.Clear();
+}
+
+LasWriter::~LasWriter()
+{
+	StopWorkers();
+	if (fd >= 0)
+		close(fd);
+	for (size_t c = 0; c < chunks.size(); c++)
+		delete chunks[c];
+}
+
+bool LasWriter::WriteAll(const void *data, size_t len, char *errbuf)
+{
+	const char *p = (const char *)data;
+
+	while (len > 0)
+	{
+		ssize_t n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+		{
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path.c_str(), strerror(errno));
+			return false;
+		}
+		p += n;
+		len -= n;
+		offset += n;
+	}
+	return true;
+}
+
+bool LasWriter::WriteHeader(char *errbuf)
+{
+	uint8_t frame[ZSTD_RAW_FRAME_OVERHEAD + LAS_HEADER_LEN];
+	uint8_t *h = frame + ZSTD_RAW_FRAME_OVERHEAD;
+	size_t len = LAS_HEADER_LEN;
+	struct tm today;
+	time_t now = time(NULL);
+
+	gmtime_r(&now, &today);
+	memset(frame, 0, sizeof(frame));
+	memcpy(h, "LASF", 4);
+	Put16(h + 6, LAS_GLOBAL_ENCODING);
+	h[24] = 1;	//version 1.4
+	h[25] = 4;
+	strncpy((char *)h + 26, "UAV 3D Mapping", 32);
+	strncpy((char *)h + 58, "LIDRCAPTURE", 32);
+	Put16(h + 90, (uint16_t)(today.tm_yday + 1));
+	Put16(h + 92, (uint16_t)(today.tm_year + 1900));
+	Put16(h + 94, LAS_HEADER_LEN);
+	Put32(h + 96, LAS_HEADER_LEN);	//no variable length records
+	h[104] = LAS_POINT_FORMAT;
+	Put16(h + 105, LAS_POINT_LEN);
+	/*the legacy point counts stay 0, they cannot be used with format 6*/
+	for (int a = 0; a < 3; a++)
+	{
+		PutDouble(h + 131 + 8 * a, LAS_SCALE);
+		PutDouble(h + 155 + 8 * a, origin[a]);
+		PutDouble(h + 179 + 16 * a, written.points > 0 ? written.max[a] : 0);
+		PutDouble(h + 187 + 16 * a, written.points > 0 ? written.min[a] : 0);
+	}
+	Put64(h + 247, written.points);
+	Put64(h + 255, written.pointsByReturn[0]);
+	Put64(h + 263, written.pointsByReturn[1]);
+
+	if (compression == LAS_ZSTD)
+	{
+		/*single segment frame with a two byte content size (stored minus 256), then a last raw block*/
+		Put32(frame, ZSTD_FRAME_MAGIC);
+		frame[4] = 0x60;
+		Put16(frame + 5, LAS_HEADER_LEN - 256);
+		uint32_t block = LAS_HEADER_LEN << 3 | 1;
+		frame[7] = (uint8_t)block;
+		frame[8] = (uint8_t)(block >> 8);
+		frame[9] = (uint8_t)(block >> 16);
+		h = frame;
+		len = sizeof(frame);
+	}
+
+	if (pwrite(fd, h, len, 0) != (ssize_t)len)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path.c_str(), strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+bool LasWriter::Open(const char *path, LasCompression compression, int workers, char *errbuf)
+{
+#ifndef HAVE_ZSTD
+	if (compression == LAS_ZSTD)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: built without zstd", path);
+		return false;
+	}
+#endif
+	this->path = path;
+	this->compression = compression;
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path, strerror(errno));
+		return false;
+	}
+
+	/*the header is written in place, the points follow it*/
+	offset = (compression == LAS_ZSTD) ? ZSTD_RAW_FRAME_OVERHEAD + LAS_HEADER_LEN : LAS_HEADER_LEN;
+	if (!WriteHeader(errbuf))
+		return false;
+	lseek(fd, (off_t)offset, SEEK_SET);
+
+	if (compression == LAS_UNCOMPRESSED)
+		workers = 0;
+	else if (workers < 1)
+		workers = 1;
+	/*two chunks per worker, one being compressed and one waiting*/
+	int chunkCount = (workers > 0) ? 2 * workers : 1;
+	for (int c = 0; c < chunkCount; c++)
+	{
+		chunks.push_back(new Chunk());
+		freeChunks.push_back(chunks.back());
+	}
+	stopping = false;
+	for (int w = 0; w < workers; w++)
+	{
+		jobs.push_back(new SpscQueue<Chunk *>(chunkCount));
+		done.push_back(new SpscQueue<Chunk *>(chunkCount));
+	}
+	for (int w = 0; w < workers; w++)
+		this->workers.push_back(std::thread(&LasWriter::Worker, this, w));
+	return true;
+}
+
+void LasWriter::Pack(const Sweep &sweep, const Pose *pose, Chunk &chunk)
+{
+	/*rotation matrix of the pose, identity without one*/
+	double r[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+	double t[3] = { 0, 0, 0 };
+	if (pose != NULL)
+	{
+		double w = pose->qw, x = pose->qx, y = pose->qy, z = pose->qz;
+		r[0][0] = 1 - 2 * (y * y + z * z);
+		r[0][1] = 2 * (x * y - w * z);
+		r[0][2] = 2 * (x * z + w * y);
+		r[1][0] = 2 * (x * y + w * z);
+		r[1][1] = 1 - 2 * (x * x + z * z);
+		r[1][2] = 2 * (y * z - w * x);
+		r[2][0] = 2 * (x * z - w * y);
+		r[2][1] = 2 * (y * z + w * x);
+		r[2][2] = 1 - 2 * (x * x + y * y);
+		t[0] = pose->x;
+		t[1] = pose->y;
+		t[2] = pose->z;
+	}
+	if (!haveOrigin)
+	{
+		for (int a = 0; a < 3; a++)
+			origin[a] = floor(t[a] / LAS_OFFSET_GRID + 0.5) * LAS_OFFSET_GRID;
+		haveOrigin = true;
+	}
+
+	const int64_t gpsShiftNs = (GPS_EPOCH_UNIX_SECONDS - LAS_GPS_LEAP_SECONDS + LAS_ADJUSTED_GPS_SHIFT) * 1000000000LL;
+	const int returns = sweep.info.dualReturn ? 2 : 1;
+	const uint8_t flags = (uint8_t)((sweep.info.sensor & 3) << 4);	//scanner channel
+	Extent &extent = chunk.extent;
+
+	extent.Clear();
+	chunk.records.resize(sweep.count * LAS_POINT_LEN);
+	uint8_t *p = chunk.records.data();
+	for (size_t i = 0; i < sweep.count; i++)
+	{
+		double v[3];
+		int32_t xyz[3];
+		for (int a = 0; a < 3; a++)
+		{
+			v[a] = r[a][0] * sweep.x[i] + r[a][1] * sweep.y[i] + r[a][2] * sweep.z[i] + t[a];
+			xyz[a] = (int32_t)lround((v[a] - origin[a]) / LAS_SCALE);
+			extent.min[a] = fmin(extent.min[a], v[a]);
+			extent.max[a] = fmax(extent.max[a], v[a]);
+		}
+		int returnNumber = (returns == 2 && sweep.returnIndex[i] == RETURN_INDEX_LAST) ? 2 : 1;
+		extent.pointsByReturn[returnNumber - 1]++;
+
+		memcpy(p, xyz, sizeof(xyz));
+		Put16(p + 12, (uint16_t)(sweep.reflectivity[i] * 257));	//scaled to the full 16 bits
+		p[14] = (uint8_t)(returnNumber | returns << 4);
+		p[15] = flags;
+		p[16] = 0;	//never classified
+		p[17] = sweep.laser[i];	//user data
+		Put16(p + 18, 0);	//scan angle
+		Put16(p + 20, (uint16_t)sweep.info.sensor);	//point source id
+		PutDouble(p + 22, ((int64_t)sweep.timeNs[i] - gpsShiftNs) * 1e-9);
+		p += LAS_POINT_LEN;
+	}
+	extent.points = sweep.count;
+}
+
+bool LasWriter::Commit(Chunk &chunk, char *errbuf)
+{
+	bool ok;
+
+	if (compression == LAS_ZSTD)
+	{
+		if (chunk.compressedLen == 0)
+		{
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: compression failed", path.c_str());
+			ok = false;
+		}
+		else
+			ok = WriteAll(chunk.compressed.data(), chunk.compressedLen, errbuf);
+	}
+	else
+		ok = WriteAll(chunk.records.data(), chunk.records.size(), errbuf);
+
+	if (ok)
+	{
+		written.Add(chunk.extent);
+		ok = WriteHeader(errbuf);
+	}
+	freeChunks.push_back(&chunk);
+	return ok;
+}
+
+bool LasWriter::CollectOne(char *errbuf)
+{
+	SpscQueue<Chunk *> &queue = *done[collected % done.size()];
+	Chunk *chunk;
+
+	while (!queue.Pop(chunk))
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	collected++;
+	return Commit(*chunk, errbuf);
+}
+
+bool LasWriter::WriteSweep(const Sweep &sweep, const Pose *pose, char *errbuf)
+{
+	bool ok = true;
+
+	if (fd < 0 || sweep.count == 0)
+		return true;
+
+	if (workers.empty())
+	{
+		Chunk &chunk = *freeChunks.back();
+		freeChunks.pop_back();
+		Pack(sweep, pose, chunk);
+		return Commit(chunk, errbuf);
+	}
+
+	/*all chunks in flight: wait for the oldest*/
+	if (freeChunks.empty())
+		ok = CollectOne(errbuf);
+	Chunk *chunk = freeChunks.back();
+	freeChunks.pop_back();
+	Pack(sweep, pose, *chunk);
+	jobs[submitted % jobs.size()]->Push(chunk);	//cannot fail, every queue has room for all chunks
+	submitted++;
+
+	/*write whatever is ready, in order*/
+	Chunk *ready;
+	while (ok && collected < submitted && done[collected % done.size()]->Pop(ready))
+	{
+		collected++;
+		ok = Commit(*ready, errbuf);
+	}
+	return ok;
+}
+
+void LasWriter::Worker(int worker)
+{
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx *context = ZSTD_createCCtx();
+	SpscQueue<Chunk *> &in = *jobs[worker];
+	SpscQueue<Chunk *> &out = *done[worker];
+
+	while (true)
+	{
+		Chunk *chunk;
+		if (!in.Pop(chunk))
+		{
+			if (stopping)
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		chunk->compressed.resize(ZSTD_compressBound(chunk->records.size()));
+		size_t len = ZSTD_compressCCtx(context, chunk->compressed.data(), chunk->compressed.size(),
+			chunk->records.data(), chunk->records.size(), LAS_ZSTD_LEVEL);
+		chunk->compressedLen = ZSTD_isError(len) ? 0 : len;
+		out.Push(chunk);	//cannot fail, the queue has room for all chunks
+	}
+	ZSTD_freeCCtx(context);
+#else
+	(void)worker;
+#endif
+}
+
+void LasWriter::StopWorkers()
+{
+	stopping = true;
+	for (size_t w = 0; w < workers.size(); w++)
+		workers[w].join();
+	workers.clear();
+	for (size_t w = 0; w < jobs.size(); w++)
+	{
+		delete jobs[w];
+		delete done[w];
+	}
+	jobs.clear();
+	done.clear();
+}
+
+bool LasWriter::Close(char *errbuf)
+{
+	bool ok = true;
+
+	if (fd < 0)
+		return true;
+	while (collected < submitted)
+		ok = CollectOne(errbuf) && ok;
+	StopWorkers();
+	if (close(fd) < 0 && ok)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path.c_str(), strerror(errno));
+		ok = false;
+	}
+	fd = -1;
+	return ok;
+}
+
+uint64_t LasWriter::Points() const
+{
+	return written.points;
+}
+
+uint64_t LasWriter::Bytes() const
+{
+	return offset;
+}
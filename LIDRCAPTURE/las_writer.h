@@ -0,0 +1,112 @@
+#ifndef LAS_WRITER_H
+#define LAS_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "deskew.h"
+#include "spsc_queue.h"
+#include "sweep_assembler.h"
+
+/*coordinates are stored as integer millimeters from an offset*/
+#define LAS_SCALE 0.001
+/*the offset is the first position rounded to this many meters, so the integers cover the whole flight*/
+#define LAS_OFFSET_GRID 1000.0
+/*leap seconds between GPS time and UTC since 2017*/
+#define LAS_GPS_LEAP_SECONDS 18
+#define LAS_DEFAULT_WORKERS 2
+
+enum LasCompression
+{
+	LAS_UNCOMPRESSED,	//a plain .las file
+	LAS_ZSTD	//the .las file as a zstd stream, one frame per sweep, needs HAVE_ZSTD
+};
+
+/*Streams sweeps into a LAS 1.4 file with point data record format 6.
+every point gets its GPS time (adjusted standard GPS time), the reflectivity as intensity, the laser id as user data,
+the sensor as point source id and scanner channel, and in dual return mode the strongest return as return 1 and the
+last as return 2 of 2. the header is rewritten after every sweep with the point counts and bounds so far, so the file
+is valid up to the last sweep even if the capture dies.
+
+with LAS_ZSTD every sweep is compressed as an independent zstd frame by one of a few worker threads; sweeps are
+dealt to the workers in turn through lock-free queues and their frames collected in the same order, so the output is
+one zstd stream that decompresses to the LAS file. the header is stored in its own uncompressed frame of fixed size
+so it can still be rewritten in place. WriteSweep only waits for a worker when all of the chunk buffers are in
+flight; it is meant to be called from the sweep consumer thread, never from the capture thread.*/
+class LasWriter
+{
+public:
+	LasWriter();
+	~LasWriter();
+
+	/*creates the file and starts the workers. returns false and fills errbuf (CAPTURE_ERRBUF_SIZE bytes) if it cannot
+	be created or the compression is not compiled in.*/
+	bool Open(const char *path, LasCompression compression, int workers, char *errbuf);
+	/*appends the points of a sweep. with a pose they are moved by it into the world frame, pass the pose at the end
+	of a deskewed sweep; without one they are written in the sensor frame.*/
+	bool WriteSweep(const Sweep &sweep, const Pose *pose, char *errbuf);
+	/*writes the sweeps still with the workers and the final header and closes the file*/
+	bool Close(char *errbuf);
+
+	uint64_t Points() const;
+	uint64_t Bytes() const;
+
+private:
+	/*point counts and bounds of a part of the file*/
+	struct Extent
+	{
+		uint64_t points;
+		uint64_t pointsByReturn[2];
+		double min[3];
+		double max[3];
+
+		void Clear();
+		void Add(const Extent &other);
+	};
+
+	/*the point records of one sweep on their way to the file*/
+	struct Chunk
+	{
+		std::vector<uint8_t> records;
+		std::vector<uint8_t> compressed;
+		size_t compressedLen;	//0 if the compression failed
+		Extent extent;
+	};
+
+	/*fills a chunk with the records of a sweep*/
+	void Pack(const Sweep &sweep, const Pose *pose, Chunk &chunk);
+	/*appends a finished chunk to the file and rewrites the header*/
+	bool Commit(Chunk &chunk, char *errbuf);
+	/*waits for the oldest chunk at the workers and commits it*/
+	bool CollectOne(char *errbuf);
+	bool WriteHeader(char *errbuf);
+	bool WriteAll(const void *data, size_t len, char *errbuf);
+	void Worker(int worker);
+	void StopWorkers();
+
+	int fd;
+	std::string path;
+	LasCompression compression;
+	uint64_t offset;	//file size so far
+	bool haveOrigin;
+	double origin[3];	//coordinate offsets of the header
+	Extent written;	//what is in the file so far
+
+	/*compression workers. chunk n goes to worker n % workers and comes back through the same worker's done queue.*/
+	std::vector<std::thread> workers;
+	std::vector<SpscQueue<Chunk *> *> jobs;
+	std::vector<SpscQueue<Chunk *> *> done;
+	std::atomic<bool> stopping;
+	std::vector<Chunk *> chunks;	//owns the buffers
+	std::vector<Chunk *> freeChunks;
+	uint64_t submitted;
+	uint64_t collected;
+
+	LasWriter(const LasWriter &);
+	LasWriter &operator=(const LasWriter &);
+};
+
+#endif
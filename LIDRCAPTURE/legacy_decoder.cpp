@@ -0,0 +1,134 @@
+#include "legacy_decoder.h"
+#include "packet_decoder.h"
+
+#include <iomanip>
+#include <iostream>
+
+using namespace std;
+
+LegacyScanState::LegacyScanState()
+	: blockCounter(0), dataBlockStatus(0), ctr(0), flag(false), gpsHeader(false), gpsByte(0), partial(0),
+	partialBytes(0)
+{
+}
+
+/*feeds one byte of a little endian value of width bytes. returns -1 until the last byte has been fed, then the
+value. replaces the old TwoByteHexConv/FourByteHexConv, which kept the partial value in globals.*/
+static int64_t AccumulateLE(LegacyScanState &state, int byte, int width)
+{
+	state.partial |= (uint32_t)byte << (8 * state.partialBytes);
+	if (++state.partialBytes < width)
+		return -1;
+
+	uint32_t val = state.partial;
+	state.partial = 0;
+	state.partialBytes = 0;
+	return val;
+}
+
+void ScanPacketBytes(LegacyScanState &state, const unsigned char *data, unsigned int len, ostream &capFile)
+{
+	int curByte = 0;	//the current byte being processed
+	int nextByte = 0;	//used in conjunction with curByte
+	int64_t value;
+
+	for (unsigned int i = 1; i < (len + 1); i++)	//this loop is just slightly different from Asher's as he started from i = 1 instead of 0.
+	{
+
+		curByte = data[i - 1];
+		nextByte = (i < len) ? data[i] : 0;	//the last byte has no successor inside the frame
+
+
+		switch (state.dataBlockStatus) {
+		case 0:	//0xFFEE has not been found, GPS sentence has not been found
+			if (curByte == 255 && nextByte == 238)	//detects 0xFFEE
+			{
+				state.dataBlockStatus = 1;
+				state.blockCounter++;
+			}
+
+			if (curByte == 36 && nextByte == 71)	//detects start of GPS sentence, "$G"
+			{
+				state.dataBlockStatus = 4;
+			}
+			break;
+		case 1: //0xFFEE has been found, begin reading and calculating azimuth value
+			if (!state.flag)
+			{
+				/*the purpose of this if statement is to skip one iteration of the for loop. in the previous loop, nextByte
+				was used to identify the block flag. In the loop after, that byte became curByte and the azimuth calculation
+				begins at the byte AFTER that one. hopefully that made sense.*/
+				state.flag = true;
+			}
+			else
+			{
+				value = AccumulateLE(state, curByte, 2);	//azimuth
+
+				if (value != -1)
+				{
+					capFile << '\n' << "angle= " << setw(10) << value << " ";
+					state.dataBlockStatus = 2;
+				}
+			}
+			break;
+		case 2:	//Azimuth value has been read. Now process the next 32 3-byte data points.
+			state.flag = false;
+
+			state.ctr++;	//keeps track of how many bytes have been read within this switch case.
+					//3 bytes per data point * 32 data points = 96 bytes total. this will be used for the logic.
+
+			if (state.ctr % 3 != 0)
+			{
+				value = AccumulateLE(state, curByte, 2);
+				if (value != -1)
+				{
+					capFile << " " << setw(10) << 2 * value; //multiplied by 2 because the precision is down to 2 millimeters
+				}
+			}
+			else
+			{
+				capFile << " " << setw(10) << curByte; //reflectivity value
+			}
+
+			if (state.ctr == CHANNELS_PER_BLOCK * RETURN_LEN)
+			{
+				state.dataBlockStatus = (state.blockCounter == BLOCKS_PER_PACKET) ? 3 : 0;
+				state.ctr = 0;
+			}
+			break;
+		case 3:	//all 12 blocks in this packet have been read, now process the timestamp and reset dataBlockStatus
+			value = AccumulateLE(state, curByte, 4);
+
+			if (value != -1)
+			{
+				capFile << '\n' << "time= " << value;
+				state.dataBlockStatus = 0;
+				state.blockCounter = 0;
+			}
+			break;
+		case 4:	//Read the GPS sentence and append it to the output
+			int cB = curByte;
+
+			if (!state.gpsHeader) {
+				capFile << "GPS= $G";
+				state.gpsHeader = true;
+				state.gpsByte = 84;
+			}
+			else
+			{
+				if (state.gpsByte > 0)
+				{
+					capFile << static_cast<char>(cB);
+					state.gpsByte--;
+				}
+				else
+				{
+					state.gpsHeader = false;
+					state.dataBlockStatus = 0;
+				}
+			}
+
+			break;
+		}
+	}
+}
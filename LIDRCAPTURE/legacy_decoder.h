@@ -0,0 +1,29 @@
+#ifndef LEGACY_DECODER_H
+#define LEGACY_DECODER_H
+
+#include <stdint.h>
+#include <ostream>
+
+/*state of the byte by byte decoder. the state machine carries it from one packet to the next, so every sensor
+(or worker thread) needs its own.*/
+struct LegacyScanState
+{
+	int blockCounter;	//counter for number of data blocks counted in a packet
+	int dataBlockStatus;	//which part of the packet the next byte belongs to, see ScanPacketBytes
+	/*counter for the number of distance and reflectivity data points processed.*/
+	int ctr;
+	bool flag;
+	bool gpsHeader;
+	int gpsByte;	//GPS sentence bytes still to copy
+	uint32_t partial;	//little endian value being assembled one byte at a time
+	int partialBytes;	//number of bytes of it seen so far
+
+	LegacyScanState();
+};
+
+/*runs every byte of a captured packet through the decoder state machine and writes the results to capFile.
+looks for the 0xFFEE block flags and "$G" GPS sentences anywhere in the data, so it also works on data that is
+not aligned to a packet.*/
+void ScanPacketBytes(LegacyScanState &state, const unsigned char *data, unsigned int len, std::ostream &capFile);
+
+#endif
@@ -0,0 +1,149 @@
+#include "lzf.h"
+
+#include <string.h>
+#include <vector>
+
+#define LZF_HASH_BITS 14
+#define LZF_MAX_LITERALS 32
+#define LZF_MAX_OFFSET 8192
+#define LZF_MAX_REFERENCE 264	//2 + 7 + 255
+
+static inline uint32_t Hash(const uint8_t *p)
+{
+	uint32_t v = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+	return (v * 2654435761u) >> (32 - LZF_HASH_BITS);
+}
+
+size_t LzfCompress(const uint8_t *in, size_t len, uint8_t *out, size_t outLen)
+{
+	/*positions plus one of the last three byte sequence with each hash, 0 is none. one table per thread, the sweep
+	writers run on their own threads.*/
+	static thread_local std::vector<uint32_t> table(1 << LZF_HASH_BITS);
+	uint8_t *op = out;
+	uint8_t *outEnd = out + outLen;
+	uint8_t *literalControl;
+	int literals = 0;
+	size_t pos = 0;
+
+	if (outLen == 0)
+		return 0;
+	memset(table.data(), 0, table.size() * sizeof(uint32_t));
+	literalControl = op++;	//control byte of the literal run being collected
+
+	while (pos + 2 < len)
+	{
+		uint32_t h = Hash(in + pos);
+		size_t ref = table[h];
+		table[h] = (uint32_t)(pos + 1);
+
+		if (ref != 0 && pos + 1 - ref <= LZF_MAX_OFFSET && memcmp(in + ref - 1, in + pos, 3) == 0)
+		{
+			size_t distance = pos + 1 - ref;
+			size_t maxLen = (len - pos < LZF_MAX_REFERENCE) ? len - pos : LZF_MAX_REFERENCE;
+			size_t matchLen = 3;
+			while (matchLen < maxLen && in[ref - 1 + matchLen] == in[pos + matchLen])
+				matchLen++;
+
+			/*close the literal run, or take back its control byte if it is empty*/
+			if (literals > 0)
+				*literalControl = (uint8_t)(literals - 1);
+			else
+				op--;
+			if (op + 4 > outEnd)	//the reference and the control byte of the next run
+				return 0;
+
+			size_t l = matchLen - 2;
+			size_t o = distance - 1;
+			if (l < 7)
+				*op++ = (uint8_t)(l << 5 | o >> 8);
+			else
+			{
+				*op++ = (uint8_t)(7 << 5 | o >> 8);
+				*op++ = (uint8_t)(l - 7);
+			}
+			*op++ = (uint8_t)o;
+
+			pos += matchLen;
+			literalControl = op++;
+			literals = 0;
+			continue;
+		}
+
+		if (op >= outEnd)
+			return 0;
+		*op++ = in[pos++];
+		if (++literals == LZF_MAX_LITERALS)
+		{
+			*literalControl = LZF_MAX_LITERALS - 1;
+			if (op >= outEnd)
+				return 0;
+			literalControl = op++;
+			literals = 0;
+		}
+	}
+
+	/*the last bytes are too few to start a reference*/
+	while (pos < len)
+	{
+		if (op >= outEnd)
+			return 0;
+		*op++ = in[pos++];
+		if (++literals == LZF_MAX_LITERALS && pos < len)
+		{
+			*literalControl = LZF_MAX_LITERALS - 1;
+			if (op >= outEnd)
+				return 0;
+			literalControl = op++;
+			literals = 0;
+		}
+	}
+	if (literals > 0)
+		*literalControl = (uint8_t)(literals - 1);
+	else
+		op--;
+	return op - out;
+}
+
+size_t LzfDecompress(const uint8_t *in, size_t len, uint8_t *out, size_t outLen)
+{
+	const uint8_t *ip = in;
+	const uint8_t *inEnd = in + len;
+	uint8_t *op = out;
+	uint8_t *outEnd = out + outLen;
+
+	while (ip < inEnd)
+	{
+		size_t control = *ip++;
+
+		if (control < LZF_MAX_LITERALS)
+		{
+			size_t literals = control + 1;
+			if (literals > (size_t)(inEnd - ip) || literals > (size_t)(outEnd - op))
+				return 0;
+			memcpy(op, ip, literals);
+			ip += literals;
+			op += literals;
+			continue;
+		}
+
+		size_t l = control >> 5;
+		if (l == 7)
+		{
+			if (ip >= inEnd)
+				return 0;
+			l += *ip++;
+		}
+		if (ip >= inEnd)
+			return 0;
+		size_t distance = ((control & 0x1f) << 8 | *ip++) + 1;
+		size_t matchLen = l + 2;
+		if (distance > (size_t)(op - out) || matchLen > (size_t)(outEnd - op))
+			return 0;
+		/*byte by byte, the reference may overlap what it writes*/
+		const uint8_t *ref = op - distance;
+		for (size_t i = 0; i < matchLen; i++)
+			op[i] = ref[i];
+		op += matchLen;
+	}
+	return op - out;
+}
@@ -0,0 +1,21 @@
+#ifndef LZF_H
+#define LZF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*LZF compression, the format of liblzf that PCD binary_compressed files use. a fast byte oriented LZ77: runs of up
+to 32 literals and back references of 3 to 264 bytes up to 8 KB back, found through a hash of the next three bytes.*/
+
+/*room LzfCompress needs for len bytes of input: 33 bytes of literal run for every 32 bytes, and the few bytes a
+reference reserves before it is written*/
+#define LZF_MAX_COMPRESSED_LEN(len) ((len) + (len) / 32 + 4)
+
+/*compresses len bytes of in into out, which has room for outLen bytes. returns the compressed length, or 0 if it
+does not fit. an out of LZF_MAX_COMPRESSED_LEN(len) bytes always fits.*/
+size_t LzfCompress(const uint8_t *in, size_t len, uint8_t *out, size_t outLen);
+/*decompresses len bytes of in into out, which has room for outLen bytes. returns the decompressed length, or 0 if
+the input is corrupt or does not fit.*/
+size_t LzfDecompress(const uint8_t *in, size_t len, uint8_t *out, size_t outLen);
+
+#endif
@@ -44,72 +44,373 @@
 #include <cmath>
 #include <cstring>
 #include <time.h>
+#include <signal.h>
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include "capture.h"
+#include "tpacket_capture.h"
+#include "udp_capture.h"
+#include "uring_capture.h"
+#include "pcap_file.h"
+#include "pcap_capture.h"
+#include "packet_decoder.h"
+#include "block_simd.h"
+#include "legacy_decoder.h"
+#include "point_convert.h"
+#include "sweep_assembler.h"
+#include "deskew.h"
+#include "recording.h"
+#include "pcd_writer.h"
+#include "las_writer.h"
+#include "async_writer.h"
+#include "packet_archive.h"
+#include "pcapng_tee.h"
+#include "segmented_output.h"
+#include "text_exporter.h"
+#include <linux/filter.h>
 
 using namespace std;
 
 #define LINE_LEN 16
 
 #pragma region "GLOBAL VARIABLES"
-/*used to store hex values in the two hex conversion functions*/
-int hex0 = 0;
-int hex1 = 0;
-int hex2 = 0;
-int hex3 = 0;
-int hex4 = 0;
-int hex5 = 0;
-int hex6 = 0;
-int hex7 = 0;
-/*describe this at some point lol*/
-int a = 0;
+/*everything one sensor's packets are decoded with. each sensor gets its own so their state machines do not mix.*/
+struct SensorDecoder
+{
+	unsigned short dataPort;	//ports the sensor sends to, used to classify its packets
+	unsigned short positionPort;
+	DataPacket packet;	//preallocated destination of the fixed offset decoder
+	const CalibrationTable *calibration;	//loaded with -c, NULL for the nominal angles
+	PointTiming timing;	//azimuth and time of every return, only filled in with -o xyz or -C
+	PointPacket points;	//packet converted to XYZ, only filled in with -o xyz or -C
+	SweepAssembler *sweeps;	//cuts the points into full rotations with -C, otherwise NULL
+	PositionPacket position;
+	LegacyScanState scan;
+	/*number of packets of each PacketKind*/
+	unsigned long long counts[PACKET_MALFORMED + 1];
+};
+
+/*run every packet through the byte state machine instead of decoding data packets by fixed offsets (-d legacy)*/
+bool legacyDecoder = false;
+/*what the decoded packets are written as (-o)*/
+enum OutputFormat
+{
+	OUTPUT_TEXT,	//azimuths and distances in LIDAR_data.txt
+	OUTPUT_XYZ,	//XYZ points in LIDAR_data.txt
+	OUTPUT_RECORDING	//binary recording in LIDAR_data.lrec, see recording.h
+};
+OutputFormat outputFormat = OUTPUT_TEXT;
+/*written with -o rec*/
+RecordingWriter recording;
+/*archives the raw payloads of the sensor packets with -a, otherwise NULL. used by the capture thread only.*/
+PacketArchiveWriter *archive = NULL;
+/*records the accepted sensor frames to LIDAR_frames.pcapng with -w, otherwise NULL. used by the capture thread only.*/
+PcapngTee *tee = NULL;
+/*splits LIDAR_data.txt into segments with -G and -M, otherwise NULL. used by the capture thread only.*/
+SegmentedOutput *segments = NULL;
+/*writes the decoded packets in the text format of the state machine. used by the capture thread only.*/
+TextExporter textExporter;
+/*assemble full rotations, cut at the angle given with -C*/
+bool assembleSweeps = false;
+/*writes every sweep to a PCD file with -W, otherwise NULL. used by the sweep consumer thread only.*/
+PcdWriter *pcdWriter = NULL;
+/*writes the sweeps to a LAS file with -L, otherwise NULL. used by the sweep consumer thread only.*/
+LasWriter *lasWriter = NULL;
+/*platform poses given with -m, the sweeps are deskewed when there are any*/
+PoseStream poses;
+/*sensor calibration given with -c*/
+CalibrationTable calibration;
+/*returns kept in the XYZ output and the sweeps, set with -R, -I, -A and -B*/
+PointFilter pointFilter;
+/*one decoder per sensor, indexed by RawPacket::sensor*/
+vector<SensorDecoder> decoders;
+/*set by SIGINT and SIGTERM, the capture backends then return so the outputs are flushed and closed*/
+atomic<bool> stopCapture(false);
+/*the live pcap capture, broken out of by the signal handler, otherwise NULL*/
+pcap_t *liveCapture = NULL;
 #pragma endregion
 
 #pragma region "FUNCTION PROTOTYPES"
-/*takes in the 2 byte values for the azimuth or distance value and returns the calculated value as an integer*/
-int TwoByteHexConv(int);
-/*takes in the 4 byte values for the time stamp and returns the calculated value as an integer*/
-int FourByteHexConv(int);
+/*classifies a captured packet by its UDP port and length, decodes it with the parser for its kind and writes the
+results to the ostream passed as user. unknown and malformed packets are only counted.*/
+void ProcessPacket(const RawPacket &, void *);
+/*writes the points of a converted data packet, one line of x y z (meters), reflectivity and time (nanoseconds since
+the epoch) per return that saw an echo, and the packet time*/
+void WritePointPacket(const DataPacket &, const PointTiming &, const PointPacket &, ostream &);
+/*writes a binary recording out in the text format of the decoder, for the scripts that read LIDAR_data.txt. returns
+false and fills errbuf if the recording cannot be read.*/
+bool ConvertRecording(const char *, ostream &, char *);
+/*runs the packets of an archive captured between fromNs and toNs through ProcessPacket, decompressing only the frames
+that overlap the range. returns false and fills errbuf if the archive cannot be read.*/
+bool ReplayArchive(const PacketArchiveReader &, uint64_t, uint64_t, void *, char *);
+/*prints the packet counts of every sensor*/
+void PrintPacketCounts(FILE *);
+/*handler of SIGINT and SIGTERM, sets stopCapture. a second signal kills the program.*/
+void StopCapture(int);
+/*consumer of the finished sweeps of every sensor, runs on its own thread until all assemblers have finished. deskews
+the sweeps, prints what it got and writes them to the point cloud files, so the disk never holds up the capture.*/
+void ConsumeSweeps();
 #pragma endregion
 
 
 int main(int argc, char **argv)
 {
 	/*VARIABLES*/
-	int curByte = 0;	//the current byte being processed
-	int nextByte = 0;	//used in conjunction with curByte
-	int blockCounter = 0;	//counter for number of data blocks counted in a packet
-	int dataBlockStatus = 0;	//used to facilitate
-	/*stores the azimuth value for current block being processed*/
-	int azimuth = 0;
-	/*temporarily stores the distance value for the current block being processed. Each of the 32 values per block get printed immediately.*/
-	int distance = 0;
-	/*counter for the number of distance and reflectivity data points processed.*/
-	int ctr = 0;
-	/*stores the time stamp*/
-	int timeStamp = 0;
-	bool flag = false;
-	int reflFlag = 0;
-	int gpsFlag = 0;
-	int gpsHeader = false;
-	int gpsByte = 0;
 	int wait = 0; //seconds before start
 	string cur;
+	const char *source = NULL;	//capture device given with -s
+	string backend = "pcap";	//capture backend given with -b
+	unsigned short dataPort = VELODYNE_DATA_PORT;	//ports the udp backend listens on, -p and -P
+	unsigned short positionPort = VELODYNE_POSITION_PORT;
+	vector<unsigned short> sensorPorts;	//data and position port pairs given with -S, one pair per sensor
+	const char *replayFile = NULL;	//recording given with -r
+	double replaySpeed = 0;	//replay pacing given with -x, 0 is as fast as possible
+	const char *calibrationFile = NULL;	//vendor calibration given with -c
+	double cutAngle = 0;	//sweep cut angle in degrees given with -C
+	const char *poseFile = NULL;	//pose trajectory given with -m
+	const char *convertFile = NULL;	//recording given with -T to convert to text
+	const char *lasFormat = NULL;	//LAS output given with -L
+	bool directIo = false;	//write the text output with O_DIRECT, -D
+	double segmentSeconds = 0;	//text output segment length given with -G, 0 is unlimited
+	double segmentMegabytes = 0;	//text output segment size given with -M, 0 is unlimited
+	const char *archiveFormat = NULL;	//packet archive compression given with -a
+	const char *archiveFile = NULL;	//packet archive given with -e to replay
+	uint64_t archiveFromNs = 0, archiveToNs = UINT64_MAX;	//time range of the archive replayed, -t
+	bool filterPoints = false;	//one of -R, -I, -A or -B was given
+	PacketArchiveReader archiveReader;
 
 #pragma region "PACKET CAPTURE CODE FROM WINPCAP"
 	pcap_if_t *alldevs, *d;
-	pcap_t *fp;
+	pcap_t *fp = NULL;
 	u_int inum, i = 0;
 	char errbuf[PCAP_ERRBUF_SIZE];
 	int res;
 	struct pcap_pkthdr *header;
 	const u_char *pkt_data;
+	TPacketCapture ring;
+	UdpCapture udp;
+	UringCapture uring;
+	PcapFileReader replay;
 
 	printf("pktdump_ex: prints the packets of the network using WinPcap.\n");
-	printf("   Usage: pktdump_ex [-s source]\n\n"
+	printf("   Usage: pktdump_ex [-s source] [-b pcap|tpacket|udp|uring] [-p data port] [-P position port]\n"
+		"                     [-S data port:position port]... [-r file.pcap|file.pcapng [-x speed]] [-d fixed|legacy]\n"
+		"                     [-o text|xyz|rec] [-T recording.lrec] [-c calibration.yaml]\n"
+		"                     [-C sweep cut angle] [-m poses.txt] [-W binary|compressed] [-L las|zstd]\n"
+		"                     [-R min:max range] [-I min reflectivity] [-A from:to azimuth]\n"
+		"                     [-B xmin:ymin:zmin:xmax:ymax:zmax] [-D] [-a lzf|lz4|zstd]\n"
+		"                     [-e archive.lpa [-t from:to]] [-w] [-G segment seconds] [-M segment MB]\n\n"
 		"   Examples:\n"
 		"      pktdump_ex -s file://c:/temp/file.acp\n"
-		"      pktdump_ex -s rpcap://\\Device\\NPF_{C8736017-F3C3-4373-94AC-9A34B7DAD998}\n\n");
+		"      pktdump_ex -s rpcap://\\Device\\NPF_{C8736017-F3C3-4373-94AC-9A34B7DAD998}\n"
+		"      pktdump_ex -s eth0 -b tpacket   (memory mapped TPACKET_V3 ring, Linux only)\n"
+		"      pktdump_ex -b udp -p 2368 -P 8308   (UDP sockets, no root or promiscuous mode needed)\n"
+		"      pktdump_ex -b uring -S 2368:8308 -S 2369:8309   (io_uring, one thread for several sensors)\n"
+		"      pktdump_ex -r flight.pcapng -x 1   (replay a recording in real time, -x 0 or no -x: as fast as possible)\n"
+		"      pktdump_ex -b udp -o rec   (binary recording in LIDAR_data.lrec)\n"
+		"      pktdump_ex -T LIDAR_data.lrec   (convert a binary recording to LIDAR_data.txt)\n"
+		"      pktdump_ex -b udp -C 180 -W compressed   (one LZF compressed PCD file per rotation)\n"
+		"      pktdump_ex -b udp -m poses.txt -L las   (georeferenced LAS 1.4 with GPS time)\n"
+		"      pktdump_ex -b udp -D   (LIDAR_data.txt written with O_DIRECT, bypassing the page cache)\n"
+		"      pktdump_ex -b udp -a zstd   (raw packets compressed into LIDAR_packets.lpa as well)\n"
+		"      pktdump_ex -e LIDAR_packets.lpa -t 1700000000:1700000060 -o xyz   (decode one minute of an archive)\n"
+		"      pktdump_ex -b udp -w   (every sensor frame recorded to LIDAR_frames.pcapng as well, replays with -r)\n"
+		"      pktdump_ex -b udp -G 60 -M 512   (LIDAR_data_000000.txt... of at most a minute or 512 MB, listed in\n"
+		"                                        LIDAR_data.idx)\n\n");
+
+	for (int arg = 1; arg < argc; arg++)
+	{
+		if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc)
+			source = argv[++arg];
+		else if (strcmp(argv[arg], "-b") == 0 && arg + 1 < argc)
+			backend = argv[++arg];
+		else if (strcmp(argv[arg], "-p") == 0 && arg + 1 < argc)
+			dataPort = (unsigned short)atoi(argv[++arg]);
+		else if (strcmp(argv[arg], "-P") == 0 && arg + 1 < argc)
+			positionPort = (unsigned short)atoi(argv[++arg]);
+		else if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc)
+		{
+			replayFile = argv[++arg];
+			backend = "file";
+		}
+		else if (strcmp(argv[arg], "-x") == 0 && arg + 1 < argc)
+			replaySpeed = atof(argv[++arg]);
+		else if (strcmp(argv[arg], "-d") == 0 && arg + 1 < argc)
+			legacyDecoder = (strcmp(argv[++arg], "legacy") == 0);
+		else if (strcmp(argv[arg], "-c") == 0 && arg + 1 < argc)
+			calibrationFile = argv[++arg];
+		else if (strcmp(argv[arg], "-C") == 0 && arg + 1 < argc)
+		{
+			cutAngle = atof(argv[++arg]);
+			assembleSweeps = true;
+		}
+		else if (strcmp(argv[arg], "-W") == 0 && arg + 1 < argc)
+		{
+			const char *format = argv[++arg];
+			if (strcmp(format, "binary") != 0 && strcmp(format, "compressed") != 0)
+			{
+				fprintf(stderr, "Expected binary or compressed after -W, got %s\n", format);
+				return -1;
+			}
+			pcdWriter = new PcdWriter("LIDAR_sweep",
+				strcmp(format, "binary") == 0 ? PCD_BINARY : PCD_BINARY_COMPRESSED);
+			assembleSweeps = true;
+		}
+		else if (strcmp(argv[arg], "-L") == 0 && arg + 1 < argc)
+		{
+			lasFormat = argv[++arg];
+			if (strcmp(lasFormat, "las") != 0 && strcmp(lasFormat, "zstd") != 0)
+			{
+				fprintf(stderr, "Expected las or zstd after -L, got %s\n", lasFormat);
+				return -1;
+			}
+			assembleSweeps = true;
+		}
+		else if (strcmp(argv[arg], "-D") == 0)
+			directIo = true;
+		else if (strcmp(argv[arg], "-a") == 0 && arg + 1 < argc)
+		{
+			archiveFormat = argv[++arg];
+			if (strcmp(archiveFormat, "lzf") != 0 && strcmp(archiveFormat, "lz4") != 0
+				&& strcmp(archiveFormat, "zstd") != 0)
+			{
+				fprintf(stderr, "Expected lzf, lz4 or zstd after -a, got %s\n", archiveFormat);
+				return -1;
+			}
+		}
+		else if (strcmp(argv[arg], "-G") == 0 && arg + 1 < argc)
+			segmentSeconds = atof(argv[++arg]);
+		else if (strcmp(argv[arg], "-M") == 0 && arg + 1 < argc)
+			segmentMegabytes = atof(argv[++arg]);
+		else if (strcmp(argv[arg], "-w") == 0)
+			tee = new PcapngTee();
+		else if (strcmp(argv[arg], "-e") == 0 && arg + 1 < argc)
+		{
+			archiveFile = argv[++arg];
+			backend = "archive";
+		}
+		else if (strcmp(argv[arg], "-t") == 0 && arg + 1 < argc)
+		{
+			double from = 0, to = 0;
+			if (sscanf(argv[++arg], "%lf:%lf", &from, &to) != 2 || from < 0 || to < from)
+			{
+				fprintf(stderr, "Expected from:to in seconds since the epoch after -t, got %s\n", argv[arg]);
+				return -1;
+			}
+			archiveFromNs = (uint64_t)(from * 1e9);
+			archiveToNs = (uint64_t)(to * 1e9);
+		}
+		else if (strcmp(argv[arg], "-m") == 0 && arg + 1 < argc)
+			poseFile = argv[++arg];
+		else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc)
+		{
+			const char *format = argv[++arg];
+			if (strcmp(format, "text") != 0 && strcmp(format, "xyz") != 0 && strcmp(format, "rec") != 0)
+			{
+				fprintf(stderr, "Expected text, xyz or rec after -o, got %s\n", format);
+				return -1;
+			}
+			outputFormat = (strcmp(format, "xyz") == 0) ? OUTPUT_XYZ
+				: (strcmp(format, "rec") == 0) ? OUTPUT_RECORDING : OUTPUT_TEXT;
+		}
+		else if (strcmp(argv[arg], "-T") == 0 && arg + 1 < argc)
+			convertFile = argv[++arg];
+		else if (strcmp(argv[arg], "-R") == 0 && arg + 1 < argc)
+		{
+			if (sscanf(argv[++arg], "%f:%f", &pointFilter.minRange, &pointFilter.maxRange) != 2)
+			{
+				fprintf(stderr, "Expected min:max range in meters after -R, got %s\n", argv[arg]);
+				return -1;
+			}
+			filterPoints = true;
+		}
+		else if (strcmp(argv[arg], "-I") == 0 && arg + 1 < argc)
+		{
+			pointFilter.minReflectivity = (uint8_t)atoi(argv[++arg]);
+			filterPoints = true;
+		}
+		else if (strcmp(argv[arg], "-A") == 0 && arg + 1 < argc)
+		{
+			double from = 0, to = 0;
+			if (sscanf(argv[++arg], "%lf:%lf", &from, &to) != 2)
+			{
+				fprintf(stderr, "Expected from:to azimuth in degrees after -A, got %s\n", argv[arg]);
+				return -1;
+			}
+			pointFilter.SetSector(from, to);
+			filterPoints = true;
+		}
+		else if (strcmp(argv[arg], "-B") == 0 && arg + 1 < argc)
+		{
+			if (sscanf(argv[++arg], "%f:%f:%f:%f:%f:%f", &pointFilter.boxMin[0], &pointFilter.boxMin[1],
+				&pointFilter.boxMin[2], &pointFilter.boxMax[0], &pointFilter.boxMax[1], &pointFilter.boxMax[2]) != 6)
+			{
+				fprintf(stderr, "Expected xmin:ymin:zmin:xmax:ymax:zmax in meters after -B, got %s\n", argv[arg]);
+				return -1;
+			}
+			filterPoints = true;
+		}
+		else if (strcmp(argv[arg], "-S") == 0 && arg + 1 < argc)
+		{
+			unsigned int sensorData = 0, sensorPosition = 0;
+			if (sscanf(argv[++arg], "%u:%u", &sensorData, &sensorPosition) != 2)
+			{
+				fprintf(stderr, "Expected data port:position port after -S, got %s\n", argv[arg]);
+				return -1;
+			}
+			sensorPorts.push_back((unsigned short)sensorData);
+			sensorPorts.push_back((unsigned short)sensorPosition);
+		}
+		else
+		{
+			fprintf(stderr, "Unknown argument %s\n", argv[arg]);
+			return -1;
+		}
+	}
+
+	/*the state machine only knows the text format*/
+	if (legacyDecoder && outputFormat != OUTPUT_TEXT)
+	{
+		fprintf(stderr, "-d legacy only writes the text output, -o xyz and -o rec need the fixed decoder\n");
+		return -1;
+	}
+
+	/*segments split the text file, a recording is one file with its own index*/
+	if (outputFormat == OUTPUT_RECORDING && (segmentSeconds > 0 || segmentMegabytes > 0))
+	{
+		fprintf(stderr, "-G and -M split the text output, they do not work with -o rec\n");
+		return -1;
+	}
+
+	/*the filter works on converted points, the text output and the recording keep every return*/
+	if (filterPoints && outputFormat != OUTPUT_XYZ && !assembleSweeps && segmentSeconds <= 0 && segmentMegabytes <= 0)
+	{
+		fprintf(stderr, "-R, -I, -A and -B only filter -o xyz, the sweeps and the segment bounds, add one of them\n");
+		return -1;
+	}
+
+	if (convertFile != NULL)
+	{
+		ofstream textFile("LIDAR_data.txt");
+		if (!ConvertRecording(convertFile, textFile, errbuf))
+		{
+			fprintf(stderr, "\nError converting the recording: %s\n", errbuf);
+			return -1;
+		}
+		return 0;
+	}
+
+	if (backend != "pcap" && backend != "tpacket" && backend != "udp" && backend != "uring" && backend != "file"
+		&& backend != "archive")
+	{
+		fprintf(stderr, "Unknown capture backend %s\n", backend.c_str());
+		return -1;
+	}
 
-	if (argc < 3)
+	/*the socket backends listen on ports and the replays read a file, none of them needs a device*/
+	if (source == NULL && backend != "udp" && backend != "uring" && backend != "file" && backend != "archive")
 	{
 
 		printf("\nNo adapter selected: printing the device list:\n");
@@ -152,29 +453,88 @@ int main(int argc, char **argv)
 
 		/* Jump to the selected adapter */
 		for (d = alldevs, i = 0; i< inum - 1; d = d->next, i++);
-		/* Open the device */
-        printf(d->name);
-		if ((fp = pcap_open_live(d->name,
-			100 /*snaplen*/,
-			1,
-			20 /*read timeout*/,
-			errbuf)
-			) == NULL)
-		{
-		    printf(errbuf);
-			fprintf(stderr, "\nError opening adapter\n");
+		source = d->name;
+        printf("%s", source);
+	}
+
+	if (source != NULL && backend != "file" && backend != "archive")
+		printf("\nCapturing UDP ports %u and %u on %s\n", dataPort, positionPort, source);
+
+	if (backend == "file")
+	{
+		if (!replay.Open(replayFile, errbuf))
+		{
+			fprintf(stderr, "\nError opening recording: %s\n", errbuf);
+			return -1;
+		}
+	}
+	else if (backend == "archive")
+	{
+		/*the packets keep the sensor numbers they were captured with, -S gives the ports of each*/
+		if (sensorPorts.empty())
+		{
+			sensorPorts.push_back(dataPort);
+			sensorPorts.push_back(positionPort);
+		}
+		if (!archiveReader.Open(archiveFile, errbuf))
+		{
+			fprintf(stderr, "\nError opening the packet archive: %s\n", errbuf);
+			return -1;
+		}
+	}
+	else if (backend == "tpacket")
+	{
+		/*the same filter as the pcap path, attached to the packet socket so the ring only holds sensor frames*/
+		struct bpf_program program;
+		struct sock_fprog filter;
+
+		if (!CompileSensorFilter(dataPort, positionPort, &program, errbuf))
+		{
+			fprintf(stderr, "\nError compiling the capture filter: %s\n", errbuf);
+			return -1;
+		}
+		filter.len = (unsigned short)program.bf_len;
+		filter.filter = (struct sock_filter *)program.bf_insns;	//struct bpf_insn has the kernel's layout
+		bool opened = ring.Open(source, errbuf, &filter);
+		pcap_freecode(&program);
+		if (!opened)
+		{
+			fprintf(stderr, "\nError opening source: %s\n", errbuf);
+			return -1;
+		}
+	}
+	else if (backend == "udp")
+	{
+		if (!udp.Open(dataPort, positionPort, errbuf))
+		{
+			fprintf(stderr, "\nError opening UDP ports: %s\n", errbuf);
 			return -1;
 		}
 	}
+	else if (backend == "uring")
+	{
+		if (sensorPorts.empty())
+		{
+			sensorPorts.push_back(dataPort);
+			sensorPorts.push_back(positionPort);
+		}
+		if (!uring.Open(errbuf))
+		{
+			fprintf(stderr, "\nError setting up io_uring: %s\n", errbuf);
+			return -1;
+		}
+		for (size_t sensor = 0; sensor < sensorPorts.size(); sensor += 2)
+		{
+			if (!uring.AddSensor(sensorPorts[sensor], sensorPorts[sensor + 1], errbuf))
+			{
+				fprintf(stderr, "\nError opening UDP ports: %s\n", errbuf);
+				return -1;
+			}
+		}
+	}
 	else
 	{
-		// Do not check for the switch type ('-s')
-		if ((fp = pcap_open_live(argv[2],
-			100 /*snaplen*/,
-			1,
-			20 /*read timeout*/,
-			errbuf)
-			) == NULL)
+		if ((fp = OpenSensorCapture(source, dataPort, positionPort, errbuf)) == NULL)
 		{
 			fprintf(stderr, "\nError opening source: %s\n", errbuf);
 			return -1;
@@ -182,9 +542,118 @@ int main(int argc, char **argv)
 	}
 #pragma endregion
 
+	if (calibrationFile != NULL && !LoadCalibration(calibrationFile, calibration, errbuf))
+	{
+		fprintf(stderr, "\nError loading the calibration: %s\n", errbuf);
+		return -1;
+	}
+
+	if (poseFile != NULL && !poses.Load(poseFile, errbuf))
+	{
+		fprintf(stderr, "\nError loading the poses: %s\n", errbuf);
+		return -1;
+	}
+
+	if (lasFormat != NULL)
+	{
+		bool compressed = (strcmp(lasFormat, "zstd") == 0);
+		lasWriter = new LasWriter();
+		if (!lasWriter->Open(compressed ? "LIDAR_points.las.zst" : "LIDAR_points.las",
+			compressed ? LAS_ZSTD : LAS_UNCOMPRESSED, LAS_DEFAULT_WORKERS, errbuf))
+		{
+			fprintf(stderr, "\nError creating the LAS file: %s\n", errbuf);
+			return -1;
+		}
+	}
+
+	if (archiveFormat != NULL)
+	{
+		archive = new PacketArchiveWriter();
+		ArchiveCompression compression = (strcmp(archiveFormat, "lz4") == 0) ? ARCHIVE_LZ4
+			: (strcmp(archiveFormat, "zstd") == 0) ? ARCHIVE_ZSTD : ARCHIVE_LZF;
+		if (!archive->Open("LIDAR_packets.lpa", compression, errbuf))
+		{
+			fprintf(stderr, "\nError creating the packet archive: %s\n", errbuf);
+			return -1;
+		}
+	}
+
+	/*the uring backend numbers its sensors in the order of -S and an archive the same way, every other backend
+	captures a single sensor*/
+	bool numberedSensors = (backend == "uring" || backend == "archive");
+	decoders.resize(numberedSensors ? sensorPorts.size() / 2 : 1);
+	for (size_t sensor = 0; sensor < decoders.size(); sensor++)
+	{
+		decoders[sensor].dataPort = numberedSensors ? sensorPorts[2 * sensor] : dataPort;
+		decoders[sensor].positionPort = numberedSensors ? sensorPorts[2 * sensor + 1] : positionPort;
+		decoders[sensor].calibration = (calibrationFile != NULL) ? &calibration : NULL;
+		decoders[sensor].sweeps = assembleSweeps
+			? new SweepAssembler((unsigned int)sensor, (unsigned int)(fmod(cutAngle + 360, 360) * 100)) : NULL;
+		memset(decoders[sensor].counts, 0, sizeof(decoders[sensor].counts));
+	}
+
+	if (tee != NULL)
+	{
+		/*one pcapng interface per sensor, named after where its frames come from*/
+		const char *origin = (source != NULL) ? source : (backend == "file") ? replayFile
+			: (backend == "archive") ? archiveFile : backend.c_str();
+		vector<PcapngInterface> interfaces(decoders.size());
+		for (size_t sensor = 0; sensor < decoders.size(); sensor++)
+		{
+			char description[128];
+			snprintf(description, sizeof(description), "sensor %u, data port %u, position port %u",
+				(unsigned int)sensor, decoders[sensor].dataPort, decoders[sensor].positionPort);
+			interfaces[sensor].name = origin;
+			interfaces[sensor].description = description;
+		}
+		if (!tee->Open("LIDAR_frames.pcapng", interfaces, errbuf))
+		{
+			fprintf(stderr, "\nError creating the pcapng recording: %s\n", errbuf);
+			return -1;
+		}
+	}
+
 	/*Declaration and initialization of the output file that we will be writing to and the input file we will be reading settings from.*/
-	ofstream capFile("LIDAR_data.txt");
-    printf("\n\nvx %i\n\n",azimuth);
+	/*the text is formatted straight into the buffers of a writer thread, a slow disk drops buffers instead of
+	stalling the capture*/
+	AsyncFileWriter textWriter;
+	AsyncStreamBuf *textBuffer = NULL;
+	ostream capFile(NULL);
+	if (outputFormat == OUTPUT_RECORDING)
+	{
+		if (!recording.Open("LIDAR_data.lrec", errbuf))
+		{
+			fprintf(stderr, "\nError creating the recording: %s\n", errbuf);
+			return -1;
+		}
+	}
+	else
+	{
+		if (segmentSeconds > 0 || segmentMegabytes > 0)
+			segments = new SegmentedOutput("LIDAR_data", "txt", (uint64_t)(segmentSeconds * 1e9),
+				(uint64_t)(segmentMegabytes * 1048576));
+		if (!textWriter.Open(segments != NULL ? segments->Path() : "LIDAR_data.txt", directIo, errbuf))
+		{
+			fprintf(stderr, "\nError creating the output file: %s\n", errbuf);
+			return -1;
+		}
+		textBuffer = new AsyncStreamBuf(textWriter);
+		capFile.rdbuf(textBuffer);
+		if (segments != NULL && !segments->Open(*textBuffer, errbuf))
+		{
+			fprintf(stderr, "\nError creating the segment index: %s\n", errbuf);
+			return -1;
+		}
+	}
+	printf("\nDecoding blocks with the %s kernel\n", DeinterleaveKernelName());
+	if (outputFormat == OUTPUT_XYZ || assembleSweeps || segments != NULL)
+	{
+		InitTimingTables();
+		InitConvertTables();
+	}
+	thread sweepConsumer;
+	if (assembleSweeps)
+		sweepConsumer = thread(ConsumeSweeps);
 /*	ifstream settings("settings.txt");
 
 	getline(settings, cur);
@@ -202,206 +671,360 @@ int main(int argc, char **argv)
 
 	//system("start IMUcap.exe");
 
+	/*Ctrl-C ends a capture like the end of a replay does, with every output written out and closed. not restarted,
+	so a backend blocked in a system call sees the flag right away.*/
+	struct sigaction stopAction;
+	memset(&stopAction, 0, sizeof(stopAction));
+	stopAction.sa_handler = StopCapture;
+	stopAction.sa_flags = SA_RESETHAND;
+	sigemptyset(&stopAction.sa_mask);
+	liveCapture = fp;
+	sigaction(SIGINT, &stopAction, NULL);
+	sigaction(SIGTERM, &stopAction, NULL);
 
-
-	/*while */
-	while ((res = pcap_next_ex(fp, &header, &pkt_data)) >= 0)
+	if (backend == "file")
 	{
-		if (res == 0) //if there is a timeout, continue to the next loop
-			continue;
+		if (replay.Run(ProcessPacket, &capFile, replaySpeed, errbuf, &stopCapture) < 0)
+			fprintf(stderr, "\nError reading the recording: %s\n", errbuf);
+		replay.PrintStats(stderr);
+	}
+	else if (backend == "archive")
+	{
+		if (!ReplayArchive(archiveReader, archiveFromNs, archiveToNs, &capFile, errbuf))
+			fprintf(stderr, "\nError reading the packet archive: %s\n", errbuf);
+	}
+	else if (backend == "tpacket")
+	{
+		/*the ring hands over the frames in place*/
+		if (ring.Run(ProcessPacket, &capFile, errbuf, &stopCapture) < 0)
+			fprintf(stderr, "\nError reading the packet ring: %s\n", errbuf);
+		ring.PrintStats(stderr);
+	}
+	else if (backend == "udp")
+	{
+		if (udp.Run(ProcessPacket, &capFile, errbuf, &stopCapture) < 0)
+			fprintf(stderr, "\nError receiving datagrams: %s\n", errbuf);
+		udp.PrintStats(stderr);
+	}
+	else if (backend == "uring")
+	{
+		if (uring.Run(ProcessPacket, &capFile, errbuf, &stopCapture) < 0)
+			fprintf(stderr, "\nError receiving datagrams: %s\n", errbuf);
+		uring.PrintStats(stderr);
+	}
+	else
+	{
+		/*returns -2 once the signal handler broke the loop, the read timeout also lets the flag be seen*/
+		while (!stopCapture && (res = pcap_next_ex(fp, &header, &pkt_data)) >= 0)
+		{
+			if (res == 0) //if there is a timeout, continue to the next loop
+				continue;
 
+			RawPacket packet;
+			packet.data = pkt_data;
+			packet.caplen = header->caplen;
+			packet.len = header->len;
+			packet.timestampNs = (uint64_t)header->ts.tv_sec * 1000000000ULL + (uint64_t)header->ts.tv_usec * 1000;
+			packet.layer = LAYER_ETHERNET;
+			packet.dstPort = 0;
+			packet.sensor = 0;
+			ProcessPacket(packet, &capFile);
+		}
+	}
+	if (stopCapture)
+		fprintf(stderr, "\nStopped, closing the outputs\n");
 
-		for (int i = 1; i < (header->caplen + 1); i++)	//this loop is just slightly different from Asher's as he started from i = 1 instead of 0.
-		{
+	/*the packet recordings and the segment index are closed before the sweeps are finished, which can take a while:
+	a second Ctrl-C in the meantime kills the program but leaves the pcapng file with every queued frame, the archive
+	and the binary recording with their last frame or chunk and their index and the segment index with its last
+	segment*/
+	if (tee != NULL)
+	{
+		if (!tee->Close(errbuf))
+			fprintf(stderr, "\nError writing the pcapng recording: %s\n", errbuf);
+		tee->PrintStats(stderr);
+		delete tee;
+	}
+	if (segments != NULL)
+	{
+		if (!segments->Close(errbuf))
+			fprintf(stderr, "\nError writing the segment index: %s\n", errbuf);
+		fprintf(stderr, "wrote %u segments, listed in LIDAR_data.idx\n", segments->Segments());
+		delete segments;
+	}
+	if (archive != NULL)
+	{
+		if (!archive->Close(errbuf))
+			fprintf(stderr, "\nError writing the packet archive: %s\n", errbuf);
+		archive->PrintStats(stderr);
+		delete archive;
+	}
+	if (outputFormat == OUTPUT_RECORDING)
+	{
+		if (!recording.Close(errbuf))
+			fprintf(stderr, "\nError writing the recording: %s\n", errbuf);
+		recording.PrintStats(stderr);
+	}
 
-			curByte = pkt_data[i - 1];
-			nextByte = pkt_data[i];
+	if (assembleSweeps)
+	{
+		for (size_t sensor = 0; sensor < decoders.size(); sensor++)
+			decoders[sensor].sweeps->Finish();
+		sweepConsumer.join();
+		for (size_t sensor = 0; sensor < decoders.size(); sensor++)
+			delete decoders[sensor].sweeps;
+	}
+	if (lasWriter != NULL)
+	{
+		if (!lasWriter->Close(errbuf))
+			fprintf(stderr, "\nError writing the LAS file: %s\n", errbuf);
+		fprintf(stderr, "wrote %llu points to the LAS file, %llu bytes\n", (unsigned long long)lasWriter->Points(),
+			(unsigned long long)lasWriter->Bytes());
+		delete lasWriter;
+	}
+	if (pcdWriter != NULL)
+	{
+		fprintf(stderr, "wrote %llu PCD files, %llu bytes\n", (unsigned long long)pcdWriter->Files(),
+			(unsigned long long)pcdWriter->Bytes());
+		delete pcdWriter;
+	}
+	if (!legacyDecoder)
+		PrintPacketCounts(stderr);
+	if (textBuffer != NULL)
+	{
+		if (!textBuffer->Close(errbuf))
+			fprintf(stderr, "\nError writing the output file: %s\n", errbuf);
+		textWriter.PrintStats(stderr);
+		delete textBuffer;
+	}
+	return 0;
+}
 
+void ProcessPacket(const RawPacket &packet, void *user)
+{
+	ostream &capFile = *(ostream *)user;
+	SensorDecoder &decoder = decoders[packet.sensor];
+	const unsigned char *payload;
+	unsigned int len;
+	unsigned short dstPort;
 
-			switch (dataBlockStatus) {
-			case 0:	//0xFFEE has not been found, GPS sentence has not been found
-				if (curByte == 255 && nextByte == 238)	//detects 0xFFEE
-				{
-					dataBlockStatus = 1;
-					blockCounter++;
-				}
+	if (legacyDecoder)
+	{
+		if (segments != NULL)
+			segments->AddPacket(packet.timestampNs);
+		ScanPacketBytes(decoder.scan, packet.data, packet.caplen, capFile);
+		return;
+	}
 
-				if (curByte == 36 && nextByte == 71)	//detects start of GPS sentence, "$G"
-				{
-					dataBlockStatus = 4;
-				}
-				break;
-			case 1: //0xFFEE has been found, begin reading and calculating azimuth value
-				if (!flag)
-				{
-					/*the purpose of this if statement is to skip one iteration of the for loop. in the previous loop, nextByte
-					was used to identify the block flag. In the loop after, that byte became curByte and the azimuth calculation
-					begins at the byte AFTER that one. hopefully that made sense.*/
-					flag = true;
-				}
-				else
-				{
-					azimuth = TwoByteHexConv(curByte);
+	PacketKind kind = PACKET_UNKNOWN;
+	if (LocateUdpPayload(packet, &payload, &len, &dstPort))
+		kind = ClassifyPayload(dstPort, len, decoder.dataPort, decoder.positionPort);
+	/*the raw frame is kept whether or not it decodes*/
+	if (archive != NULL && kind != PACKET_UNKNOWN)
+		archive->AddPacket(payload, len, packet.timestampNs, dstPort, packet.sensor);
+	if (tee != NULL && kind != PACKET_UNKNOWN)
+		tee->AddPacket(packet);
+	/*a new segment can only start between the packets that are written*/
+	if (segments != NULL && kind != PACKET_UNKNOWN)
+		segments->AddPacket(packet.timestampNs);
 
-					if (azimuth != -1)
-					{
-						capFile << endl << "angle= " << setw(10) << azimuth << " ";
-						dataBlockStatus = 2;
-					}
-				}
-				break;
-			case 2:	//Azimuth value has been read. Now process the next 32 3-byte data points.
-				flag = false;
+	switch (kind)
+	{
+	case PACKET_DATA:
+		if (DecodeDataPacket(payload, len, decoder.packet) != DECODE_OK)
+		{
+			kind = PACKET_MALFORMED;	//a block without its 0xFFEE flag or an unknown product id
+			break;
+		}
+		if (outputFormat == OUTPUT_XYZ || decoder.sweeps != NULL || segments != NULL)
+		{
+			ComputePointTiming(decoder.packet, packet.timestampNs, decoder.timing);
+			ConvertPacket(decoder.packet, decoder.timing, decoder.calibration, pointFilter, decoder.points);
+		}
+		if (segments != NULL)
+			segments->AddPoints(decoder.points);
+		if (decoder.sweeps != NULL)
+			decoder.sweeps->AddPacket(decoder.packet, decoder.timing, decoder.points);
+		if (outputFormat == OUTPUT_RECORDING)
+			recording.AddDataPacket(decoder.packet, packet.timestampNs, packet.sensor);
+		else if (outputFormat == OUTPUT_XYZ)
+			WritePointPacket(decoder.packet, decoder.timing, decoder.points, capFile);
+		else
+			textExporter.WriteDataPacket(decoder.packet, capFile);
+		break;
+	case PACKET_POSITION:
+		if (DecodePositionPacket(payload, len, decoder.position) != DECODE_OK)
+		{
+			kind = PACKET_MALFORMED;
+			break;
+		}
+		if (outputFormat == OUTPUT_RECORDING)
+			recording.AddPositionPacket(decoder.position, packet.timestampNs, packet.sensor);
+		else
+			textExporter.WritePositionPacket(decoder.position, capFile);
+		break;
+	default:
+		break;
+	}
+	decoder.counts[kind]++;
+}
 
-				ctr++;	//keeps track of how many bytes have been read within this switch case.
-						//3 bytes per data point * 32 data points = 96 bytes total. this will be used for the logic.
+void WritePointPacket(const DataPacket &dataPacket, const PointTiming &timing, const PointPacket &points,
+	ostream &capFile)
+{
+	capFile << fixed << setprecision(3);
+	for (int b = 0; b < BLOCKS_PER_PACKET; b++)
+	{
+		const DataBlock &block = dataPacket.blocks[b];
+		const PointBlock &point = points.blocks[b];
 
-				if (ctr % 3 != 0)
-				{
-					distance = 2 * TwoByteHexConv(curByte); //multiplied by 2 because the precision is down to 2 millimeters
-					if (distance > -1)
-					{
-						capFile << " " << setw(10) << distance;
-					}
-					distance = -1;
-				}
-				else
-				{
-					capFile << " " << setw(10) << curByte; //reflectivity value
-				}
+		for (int c = 0; c < CHANNELS_PER_BLOCK; c++)
+		{
+			if (!point.keep[c])
+				continue;
+			capFile << '\n' << point.x[c] << " " << point.y[c] << " " << point.z[c] << " " << (int)block.reflectivity[c]
+				<< " " << timing.timeNs[b][c];
+		}
+	}
+	capFile << '\n' << "time= " << dataPacket.timestamp;
+}
 
-				if (ctr == 96)
-				{
-					//TODO::convert to if-else statement
-					switch (blockCounter)
-					{
-					case 12:
-						dataBlockStatus = 3;
-						ctr = 0;
-						break;
-					default:
-						dataBlockStatus = 0;
-						ctr = 0;
-						break;
-					}
-				}
-				break;
-			case 3:	//all 12 blocks in this packet have been read, now process the timestamp and reset dataBlockStatus
-				timeStamp = FourByteHexConv(curByte);
+bool ConvertRecording(const char *path, ostream &textFile, char *errbuf)
+{
+	RecordingReader reader;
+	TextExporter exporter;
+	RecordingChunk chunk;
+	DataPacket dataPacket;
+	PositionPacket position;
 
-				if (timeStamp != -1)
-				{
-					capFile << endl << "time= " << timeStamp;
-					dataBlockStatus = 0;
-					blockCounter = 0;
-				}
-				break;
-			case 4:	//Read and immediately print the GPS sentence to the output
-				int cB = curByte;
-				cout << endl;
-
-				if (!gpsHeader) {
-					capFile << "GPS= $G" << flush;
-					gpsHeader = true;
-					gpsByte = 84;
-				}
-				else
-				{
-					if (gpsByte > 0)
-					{
-						capFile << static_cast<char>(cB) << flush;
-						gpsByte--;
-					}
-					else
-					{
-						gpsHeader = false;
-						dataBlockStatus = 0;
-					}
-				}
+	if (!reader.Open(path, errbuf))
+		return false;
+	for (size_t c = 0; c < reader.Chunks(); c++)
+	{
+		uint32_t data = 0, positions = 0;
 
-				break;
+		/*the kind column puts the packets of both kinds back in the order they arrived*/
+		reader.ReadChunk(c, chunk);
+		for (uint32_t r = 0; r < chunk.records; r++)
+		{
+			if (chunk.kind[r] == RECORD_DATA)
+			{
+				RecordingReader::GetDataPacket(chunk, data++, dataPacket);
+				exporter.WriteDataPacket(dataPacket, textFile);
+			}
+			else
+			{
+				RecordingReader::GetPositionPacket(chunk, positions++, position);
+				exporter.WritePositionPacket(position, textFile);
 			}
 		}
 	}
-
-	capFile.close();
-	return 0;
+	return true;
 }
 
+bool ReplayArchive(const PacketArchiveReader &reader, uint64_t fromNs, uint64_t toNs, void *user, char *errbuf)
+{
+	vector<uint8_t> frame;
+	RawPacket packet;
+	size_t framesRead = 0;
+	unsigned long long packets = 0;
+
+	for (size_t f = 0; f < reader.Frames() && !stopCapture; f++)
+	{
+		const ArchiveIndexEntry &entry = reader.Index(f);
+		if (entry.endNs < fromNs || entry.startNs > toNs)
+			continue;
+		if (!reader.ReadFrame(f, frame, errbuf))
+			return false;
+		framesRead++;
 
+		size_t offset = 0;
+		while (PacketArchiveReader::GetPacket(frame, offset, packet))
+		{
+			if (packet.timestampNs < fromNs || packet.timestampNs > toNs || packet.sensor >= decoders.size())
+				continue;
+			ProcessPacket(packet, user);
+			packets++;
+		}
+	}
+	fprintf(stderr, "archive: %llu packets from %zu of %zu frames\n", packets, framesRead, reader.Frames());
+	return true;
+}
 
-int TwoByteHexConv(int hexVal)
+void StopCapture(int)
 {
-	int val = 0;
+	stopCapture = true;
+	if (liveCapture != NULL)
+		pcap_breakloop(liveCapture);
+}
 
-	switch (a)
+void PrintPacketCounts(FILE *out)
+{
+	for (size_t sensor = 0; sensor < decoders.size(); sensor++)
 	{
-	case 0:
-		//cout << hexVal << " : ";
-		hex1 = floor (hexVal / 16);
-		//cout << hex1;
-		hex0 = hexVal - (hex1 * 16);
-		//cout << "  " << hex0 << endl;
-		a++;
-		break;
-	case 1:
-		//cout << hexVal << " : ";
-		hex3 = floor (hexVal / 16);
-		//cout << hex3;
-		hex2 = hexVal - (hex3 * 16);
-		//cout << "  " << hex2 << endl;
-
-		val = (hex3 * pow(16, 3)) + (hex2 * pow(16, 2)) + (hex1 * 16) + hex0;
-		hex0 = hex1 = hex2 = hex3 = 0;
-		a = 0;
-		return val;
-	}
-	return -1;
+		const SensorDecoder &decoder = decoders[sensor];
+
+		fprintf(out, "sensor %u (ports %u/%u): %llu data, %llu position, %llu unknown, %llu malformed packets\n",
+			(unsigned int)sensor, decoder.dataPort, decoder.positionPort, decoder.counts[PACKET_DATA],
+			decoder.counts[PACKET_POSITION], decoder.counts[PACKET_UNKNOWN], decoder.counts[PACKET_MALFORMED]);
+	}
 }
 
-int FourByteHexConv(int hexVal)
+void ConsumeSweeps()
 {
-	int val = 0;
+	bool finished = false;
+	char errbuf[CAPTURE_ERRBUF_SIZE];
 
-	switch (a)
+	while (!finished)
 	{
-	case 0:
-		//cout << "case 0; " << hexVal << endl;
-		hex1 = floor(hexVal / 16);
-		hex0 = hexVal - (hex1 * 16);
-		// << "   hex1, hex0: " << hex1 << ", " << hex0 << endl;
-		a++;
-		break;
-	case 1:
-		//cout << "case 1; " << hexVal << endl;
-		hex3 = floor(hexVal / 16);
-		hex2 = hexVal - (hex3 * 16);
-		//cout << "   hex3, hex2: " << hex3 << ", " << hex2 << endl;
-		a++;
-		break;
-	case 2:
-		//cout << "case 2; " << hexVal << endl;
-		hex5 = floor(hexVal / 16);
-		hex4 = hexVal - (hex5 * 16);
-		//cout << "   hex5, hex4: " << hex5 << ", " << hex4 << endl;
-		a++;
-		break;
-	case 3:
-		//cout << "case 3; " << hexVal << endl;
-		hex7 = floor(hexVal / 16);
-		hex6 = hexVal - (hex7 * 16);
-		//cout << "   hex7, hex6: " << hex7 << ", " << hex6 << endl;
-		a++;
-		break;
-	case 4:
-		//cout << "CALCULATING;" << endl << endl;
-		//cout << hex7 << ", " << hex6 << ", " << hex5 << ", " << hex4 << ", " << hex3 << ", " << hex2 << ", " << hex1 << ", " << hex0 << endl;
-		val = (hex7 * pow(16, 7)) + (hex6 * pow(16, 6)) + (hex5 * pow(16, 5)) + (hex4 * pow(16, 4))
-				+ (hex3 * pow(16, 3)) + (hex2 * pow(16, 2)) + (hex1 * 16) + hex0;
-		hex7 = hex6 = hex5 = hex4 = hex3 = hex2 = hex1 = hex0 = 0;
-		a = 0;
-		return val;
-	}
-
-	return -1;
-}
\ No newline at end of file
+		bool idle = true;
+
+		finished = true;
+		for (size_t sensor = 0; sensor < decoders.size(); sensor++)
+		{
+			SweepAssembler &assembler = *decoders[sensor].sweeps;
+			Sweep *sweep;
+
+			/*Finished is checked before Acquire so a sweep published just before the end is not missed*/
+			bool done = assembler.Finished();
+			while (assembler.Acquire(sweep))
+			{
+				const SweepInfo &info = sweep->info;
+				size_t unposed = 0;
+
+				if (poses.Size() > 0 && !DeskewSweep(poses, *sweep, &unposed))
+					fprintf(stderr, "sweep %llu of sensor %u: no pose for the end of the sweep, not deskewed\n",
+						(unsigned long long)info.sequence, info.sensor);
+				printf("sweep %llu of sensor %u (%s%s%s): %zu points from %u packets (%u missing, %zu points dropped) "
+					"in %.1f ms\n", (unsigned long long)info.sequence, info.sensor, SensorModelName(info.model),
+					info.complete ? "" : ", partial", info.deskewed ? ", deskewed" : "", sweep->count, info.packets,
+					info.missingPackets, info.droppedPoints, (info.endNs - info.startNs) / 1e6);
+				if (unposed > 0)
+					fprintf(stderr, "sweep %llu of sensor %u: %zu points older than the first pose\n",
+						(unsigned long long)info.sequence, info.sensor, unposed);
+				if (pcdWriter != NULL && !pcdWriter->WriteSweep(*sweep, errbuf))
+					fprintf(stderr, "sweep %llu of sensor %u: %s\n", (unsigned long long)info.sequence, info.sensor,
+						errbuf);
+				if (lasWriter != NULL)
+				{
+					/*with poses the LAS file is in the world frame, a sweep that could not be placed is left out*/
+					Pose pose;
+					bool posed = info.deskewed && poses.Interpolate(info.endNs, pose);
+					if (poses.Size() > 0 && !posed)
+						fprintf(stderr, "sweep %llu of sensor %u: no pose, left out of the LAS file\n",
+							(unsigned long long)info.sequence, info.sensor);
+					else if (!lasWriter->WriteSweep(*sweep, posed ? &pose : NULL, errbuf))
+						fprintf(stderr, "sweep %llu of sensor %u: %s\n", (unsigned long long)info.sequence,
+							info.sensor, errbuf);
+				}
+				assembler.Release(sweep);
+				idle = false;
+			}
+			finished = finished && done;
+		}
+
+		/*nothing to do, wait for the next rotation rather than spin*/
+		if (idle && !finished)
+			this_thread::sleep_for(chrono::milliseconds(1));
+	}
+}
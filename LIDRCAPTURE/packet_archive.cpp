@@ -0,0 +1,520 @@
+#include "packet_archive.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lzf.h"
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/*low levels keep up with several sensors on one core, the packets compress about as well at higher ones*/
+#define ARCHIVE_ZSTD_LEVEL 3
+
+static_assert(sizeof(ArchiveFileHeader) == 32, "file header layout");
+static_assert(sizeof(ArchiveFrameHeader) == 32, "frame header layout");
+static_assert(sizeof(ArchivePacketHeader) == 16, "packet header layout");
+static_assert(sizeof(ArchiveIndexEntry) == 32, "index entry layout");
+static_assert(sizeof(ArchiveTrailer) == 24, "trailer layout");
+
+static const char *CompressionName(ArchiveCompression compression)
+{
+	switch (compression)
+	{
+	case ARCHIVE_LZ4:
+		return "lz4";
+	case ARCHIVE_ZSTD:
+		return "zstd";
+	default:
+		return "lzf";
+	}
+}
+
+/*false if the compressor is not compiled in*/
+static bool CompressionAvailable(ArchiveCompression compression)
+{
+#ifndef HAVE_LZ4
+	if (compression == ARCHIVE_LZ4)
+		return false;
+#endif
+#ifndef HAVE_ZSTD
+	if (compression == ARCHIVE_ZSTD)
+		return false;
+#endif
+	return compression == ARCHIVE_LZF || compression == ARCHIVE_LZ4 || compression == ARCHIVE_ZSTD;
+}
+
+static void ClearFrameHeader(ArchiveFrameHeader &header)
+{
+	memcpy(header.magic, ARCHIVE_FRAME_MAGIC, sizeof(header.magic));
+	header.packets = 0;
+	header.rawLength = 0;
+	header.compressedLength = 0;
+	header.startNs = UINT64_MAX;
+	header.endNs = 0;
+}
+
+PacketArchiveWriter::PacketArchiveWriter()
+	: fd(-1), compression(ARCHIVE_LZF), context(NULL), packets(0), droppedFrames(0), droppedPackets(0), offset(0),
+	rawBytes(0), writeError(0)
+{
+}
+
+PacketArchiveWriter::~PacketArchiveWriter()
+{
+	char errbuf[CAPTURE_ERRBUF_SIZE];
+
+	if (fd >= 0)
+		Close(errbuf);
+	for (size_t f = 0; f < frames.size(); f++)
+		delete frames[f];
+}
+
+bool PacketArchiveWriter::WriteAll(const void *data, size_t len)
+{
+	const char *p = (const char *)data;
+
+	while (len > 0)
+	{
+		ssize_t n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+		{
+			if (writeError == 0)
+				writeError = errno;
+			return false;
+		}
+		p += n;
+		len -= n;
+		offset += n;
+	}
+	return true;
+}
+
+bool PacketArchiveWriter::Open(const char *path, ArchiveCompression compression, char *errbuf)
+{
+	ArchiveFileHeader header;
+	struct timespec now;
+
+	if (!CompressionAvailable(compression))
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: built without %s", path, CompressionName(compression));
+		return false;
+	}
+	this->path = path;
+	this->compression = compression;
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path, strerror(errno));
+		return false;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+	header.version = ARCHIVE_VERSION;
+	header.compression = compression;
+	header.createdNs = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+	offset = 0;
+	writeError = 0;
+	index.clear();
+	if (!WriteAll(&header, sizeof(header)))
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path, strerror(writeError));
+		close(fd);
+		fd = -1;
+		return false;
+	}
+
+	for (int f = 0; f < ARCHIVE_FRAMES; f++)
+	{
+		Frame *frame = new Frame();
+		frame->raw.resize(ARCHIVE_FRAME_BYTES);
+		ClearFrameHeader(frame->header);
+		frames.push_back(frame);
+	}
+#ifdef HAVE_ZSTD
+	if (compression == ARCHIVE_ZSTD)
+		context = ZSTD_createCCtx();
+#endif
+	pool.Start(frames, [this](Frame &frame) { WriteFrame(frame); });
+	return true;
+}
+
+void PacketArchiveWriter::AddPacket(const unsigned char *payload, unsigned int len, uint64_t timestampNs,
+	unsigned short dstPort, unsigned int sensor)
+{
+	ArchivePacketHeader packet;
+
+	Frame *frame = pool.Current();
+
+	if (frame == NULL || len > UINT16_MAX)
+		return;
+	if (frame->header.packets > 0 && (frame->header.rawLength + sizeof(packet) + len > ARCHIVE_FRAME_BYTES
+		|| timestampNs >= frame->header.startNs + ARCHIVE_FRAME_NS))
+	{
+		Submit();
+		frame = pool.Current();
+	}
+
+	ArchiveFrameHeader &header = frame->header;
+	uint8_t *p = frame->raw.data() + header.rawLength;
+	memset(&packet, 0, sizeof(packet));
+	packet.timestampNs = timestampNs;
+	packet.length = (uint16_t)len;
+	packet.dstPort = dstPort;
+	packet.sensor = (uint8_t)sensor;
+	memcpy(p, &packet, sizeof(packet));
+	memcpy(p + sizeof(packet), payload, len);
+
+	header.packets++;
+	header.rawLength += (uint32_t)(sizeof(packet) + len);
+	if (timestampNs < header.startNs)
+		header.startNs = timestampNs;
+	if (timestampNs > header.endNs)
+		header.endNs = timestampNs;
+	packets++;
+}
+
+void PacketArchiveWriter::Submit(bool last)
+{
+	uint32_t framePackets = pool.Current()->header.packets;
+
+	if (!pool.Submit(last))
+	{
+		/*the worker is behind: drop this frame rather than hold up the capture*/
+		droppedFrames++;
+		droppedPackets += framePackets;
+		packets -= framePackets;
+	}
+	ClearFrameHeader(pool.Current()->header);
+}
+
+void PacketArchiveWriter::Compress(Frame &frame)
+{
+	ArchiveFrameHeader &header = frame.header;
+	const uint8_t *raw = frame.raw.data();
+	size_t rawLength = header.rawLength;
+	size_t len = 0;
+
+	switch (compression)
+	{
+	case ARCHIVE_LZF:
+		/*anything that does not get smaller is stored*/
+		frame.compressed.resize(rawLength);
+		len = LzfCompress(raw, rawLength, frame.compressed.data(), rawLength - 1);
+		break;
+	case ARCHIVE_LZ4:
+#ifdef HAVE_LZ4
+		{
+			frame.compressed.resize(LZ4_compressBound((int)rawLength));
+			int n = LZ4_compress_default((const char *)raw, (char *)frame.compressed.data(), (int)rawLength,
+				(int)frame.compressed.size());
+			len = (n > 0) ? n : 0;
+		}
+#endif
+		break;
+	case ARCHIVE_ZSTD:
+#ifdef HAVE_ZSTD
+		frame.compressed.resize(ZSTD_compressBound(rawLength));
+		len = ZSTD_compressCCtx((ZSTD_CCtx *)context, frame.compressed.data(), frame.compressed.size(), raw, rawLength,
+			ARCHIVE_ZSTD_LEVEL);
+		if (ZSTD_isError(len))
+			len = 0;
+#endif
+		break;
+	}
+	header.compressedLength = (len > 0 && len < rawLength) ? (uint32_t)len : (uint32_t)rawLength;
+}
+
+void PacketArchiveWriter::WriteFrame(Frame &frame)
+{
+	Compress(frame);
+	const ArchiveFrameHeader &header = frame.header;
+	const uint8_t *body = (header.compressedLength == header.rawLength) ? frame.raw.data() : frame.compressed.data();
+	ArchiveIndexEntry entry;
+	entry.offset = offset;
+	entry.startNs = header.startNs;
+	entry.endNs = header.endNs;
+	entry.packets = header.packets;
+	entry.compressedLength = header.compressedLength;
+	if (writeError == 0 && WriteAll(&header, sizeof(header)) && WriteAll(body, header.compressedLength))
+	{
+		index.push_back(entry);
+		rawBytes += header.rawLength;
+	}
+}
+
+bool PacketArchiveWriter::Close(char *errbuf)
+{
+	ArchiveTrailer trailer;
+	bool ok = true;
+
+	if (fd < 0)
+		return true;
+
+	/*the end of the archive is not dropped*/
+	if (pool.Current()->header.packets > 0)
+		Submit(true);
+	pool.Stop();
+#ifdef HAVE_ZSTD
+	ZSTD_freeCCtx((ZSTD_CCtx *)context);
+#endif
+	context = NULL;
+
+	memset(&trailer, 0, sizeof(trailer));
+	trailer.indexOffset = offset;
+	trailer.frames = (uint32_t)index.size();
+	memcpy(trailer.magic, ARCHIVE_TRAILER_MAGIC, sizeof(trailer.magic));
+	if (writeError == 0)
+	{
+		WriteAll(index.data(), index.size() * sizeof(ArchiveIndexEntry));
+		if (writeError == 0)
+			WriteAll(&trailer, sizeof(trailer));
+	}
+	if (writeError != 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path.c_str(), strerror(writeError));
+		ok = false;
+	}
+	if (close(fd) < 0 && ok)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path.c_str(), strerror(errno));
+		ok = false;
+	}
+	fd = -1;
+	return ok;
+}
+
+void PacketArchiveWriter::PrintStats(FILE *out) const
+{
+	uint64_t compressedBytes = 0;
+
+	for (size_t f = 0; f < index.size(); f++)
+		compressedBytes += index[f].compressedLength;
+	fprintf(out, "%s: %llu packets in %zu %s frames, %llu bytes compressed to %llu (%.2f:1), "
+		"%llu frames (%llu packets) dropped waiting for the compressor\n", path.c_str(), (unsigned long long)packets,
+		index.size(), CompressionName(compression), (unsigned long long)rawBytes, (unsigned long long)compressedBytes,
+		compressedBytes > 0 ? (double)rawBytes / compressedBytes : 0.0, (unsigned long long)droppedFrames,
+		(unsigned long long)droppedPackets);
+}
+
+PacketArchiveReader::PacketArchiveReader()
+	: fd(-1), map(NULL), mapSize(0), compression(ARCHIVE_LZF)
+{
+}
+
+PacketArchiveReader::~PacketArchiveReader()
+{
+	Close();
+}
+
+bool PacketArchiveReader::Open(const char *path, char *errbuf)
+{
+	struct stat st;
+	ArchiveFileHeader header;
+
+	Close();
+	this->path = path;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path, strerror(errno));
+		Close();
+		return false;
+	}
+	if ((size_t)st.st_size < sizeof(ArchiveFileHeader))
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: too short for a packet archive", path);
+		Close();
+		return false;
+	}
+
+	mapSize = (size_t)st.st_size;
+	void *m = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (m == MAP_FAILED)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: mmap: %s", path, strerror(errno));
+		map = NULL;
+		Close();
+		return false;
+	}
+	map = (const unsigned char *)m;
+
+	memcpy(&header, map, sizeof(header));
+	if (memcmp(header.magic, ARCHIVE_MAGIC, sizeof(header.magic)) != 0 || header.version != ARCHIVE_VERSION)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: not a version %d packet archive", path, ARCHIVE_VERSION);
+		Close();
+		return false;
+	}
+	compression = (ArchiveCompression)header.compression;
+	if (!CompressionAvailable(compression))
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: compressed with %s, built without it", path,
+			CompressionName(compression));
+		Close();
+		return false;
+	}
+
+	if (!LoadIndex())
+		ScanFrames();
+	return true;
+}
+
+void PacketArchiveReader::Close()
+{
+	if (map != NULL)
+		munmap((void *)map, mapSize);
+	if (fd >= 0)
+		close(fd);
+	map = NULL;
+	mapSize = 0;
+	fd = -1;
+	index.clear();
+}
+
+bool PacketArchiveReader::ValidFrame(uint64_t offset, uint64_t limit) const
+{
+	ArchiveFrameHeader header;
+
+	if (offset + sizeof(header) > limit)
+		return false;
+	memcpy(&header, map + offset, sizeof(header));
+	return memcmp(header.magic, ARCHIVE_FRAME_MAGIC, sizeof(header.magic)) == 0
+		&& header.rawLength <= ARCHIVE_FRAME_BYTES && header.compressedLength <= header.rawLength
+		&& header.compressedLength <= limit - offset - sizeof(header);
+}
+
+bool PacketArchiveReader::LoadIndex()
+{
+	ArchiveTrailer trailer;
+
+	if (mapSize < sizeof(ArchiveFileHeader) + sizeof(ArchiveTrailer))
+		return false;
+	memcpy(&trailer, map + mapSize - sizeof(trailer), sizeof(trailer));
+	if (memcmp(trailer.magic, ARCHIVE_TRAILER_MAGIC, sizeof(trailer.magic)) != 0
+		|| trailer.indexOffset < sizeof(ArchiveFileHeader)
+		|| trailer.indexOffset + (uint64_t)trailer.frames * sizeof(ArchiveIndexEntry) + sizeof(ArchiveTrailer)
+			!= mapSize)
+		return false;
+
+	index.resize(trailer.frames);
+	memcpy(index.data(), map + trailer.indexOffset, index.size() * sizeof(ArchiveIndexEntry));
+	for (size_t f = 0; f < index.size(); f++)
+	{
+		if (!ValidFrame(index[f].offset, trailer.indexOffset))
+		{
+			index.clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+void PacketArchiveReader::ScanFrames()
+{
+	uint64_t offset = sizeof(ArchiveFileHeader);
+
+	index.clear();
+	while (ValidFrame(offset, mapSize))
+	{
+		ArchiveFrameHeader header;
+		ArchiveIndexEntry entry;
+
+		memcpy(&header, map + offset, sizeof(header));
+		entry.offset = offset;
+		entry.startNs = header.startNs;
+		entry.endNs = header.endNs;
+		entry.packets = header.packets;
+		entry.compressedLength = header.compressedLength;
+		index.push_back(entry);
+		offset += sizeof(header) + header.compressedLength;
+	}
+}
+
+size_t PacketArchiveReader::Frames() const
+{
+	return index.size();
+}
+
+const ArchiveIndexEntry &PacketArchiveReader::Index(size_t frame) const
+{
+	return index[frame];
+}
+
+bool PacketArchiveReader::ReadFrame(size_t frame, std::vector<uint8_t> &raw, char *errbuf) const
+{
+	ArchiveFrameHeader header;
+	size_t len = 0;
+
+	memcpy(&header, map + index[frame].offset, sizeof(header));
+	const uint8_t *body = map + index[frame].offset + sizeof(header);
+	raw.resize(header.rawLength);
+
+	if (header.compressedLength == header.rawLength)
+	{
+		memcpy(raw.data(), body, header.rawLength);
+		return true;
+	}
+	switch (compression)
+	{
+	case ARCHIVE_LZF:
+		len = LzfDecompress(body, header.compressedLength, raw.data(), raw.size());
+		break;
+	case ARCHIVE_LZ4:
+#ifdef HAVE_LZ4
+		{
+			int n = LZ4_decompress_safe((const char *)body, (char *)raw.data(), (int)header.compressedLength,
+				(int)raw.size());
+			len = (n > 0) ? n : 0;
+		}
+#endif
+		break;
+	case ARCHIVE_ZSTD:
+#ifdef HAVE_ZSTD
+		len = ZSTD_decompress(raw.data(), raw.size(), body, header.compressedLength);
+		if (ZSTD_isError(len))
+			len = 0;
+#endif
+		break;
+	}
+	if (len != header.rawLength)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: frame %zu at offset %llu is corrupt", path.c_str(), frame,
+			(unsigned long long)index[frame].offset);
+		return false;
+	}
+	return true;
+}
+
+bool PacketArchiveReader::GetPacket(const std::vector<uint8_t> &raw, size_t &offset, RawPacket &packet)
+{
+	ArchivePacketHeader header;
+
+	if (offset + sizeof(header) > raw.size())
+		return false;
+	memcpy(&header, raw.data() + offset, sizeof(header));
+	if (offset + sizeof(header) + header.length > raw.size())
+		return false;
+
+	packet.data = raw.data() + offset + sizeof(header);
+	packet.caplen = header.length;
+	packet.len = header.length;
+	packet.timestampNs = header.timestampNs;
+	packet.layer = LAYER_UDP_PAYLOAD;
+	packet.dstPort = header.dstPort;
+	packet.sensor = header.sensor;
+	offset += sizeof(header) + header.length;
+	return true;
+}
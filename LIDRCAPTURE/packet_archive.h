@@ -0,0 +1,191 @@
+#ifndef PACKET_ARCHIVE_H
+#define PACKET_ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "buffer_pool.h"
+#include "capture.h"
+
+/*Compressed archive of the raw sensor packets (.lpa), kept for reprocessing.
+
+layout, every number little endian:
+	file header	ArchiveFileHeader
+	frame		ArchiveFrameHeader, then the compressed packets
+	...
+	index		one ArchiveIndexEntry per frame
+	trailer		ArchiveTrailer
+
+a frame holds the UDP payloads of the packets captured in about a second, each behind an ArchivePacketHeader, and is
+compressed on its own, so any frame can be decompressed without the ones before it. the index gives the capture time
+range of every frame: a time range is read by decompressing only the frames that overlap it. a frame that did not get
+smaller is stored as it is, its compressed length is then its raw length. the index and trailer are only written on
+Close; an archive that was cut short is still readable, the reader then walks the frames from the start.*/
+
+#define ARCHIVE_MAGIC "LIDRPKA1"
+#define ARCHIVE_FRAME_MAGIC "FRME"
+#define ARCHIVE_TRAILER_MAGIC "LIDRPKX1"
+#define ARCHIVE_VERSION 1
+/*a frame is closed when its packets fill this many bytes or span this much capture time*/
+#define ARCHIVE_FRAME_BYTES (1 << 20)
+#define ARCHIVE_FRAME_NS 1000000000ULL
+/*frames in the pool, one being filled and the rest waiting for or at the worker*/
+#define ARCHIVE_FRAMES 4
+
+/*compressor of every frame of an archive, chosen when it is opened*/
+enum ArchiveCompression
+{
+	ARCHIVE_LZF,	//built in, fastest to set up and weakest
+	ARCHIVE_LZ4,	//fast, needs HAVE_LZ4
+	ARCHIVE_ZSTD	//best ratio, needs HAVE_ZSTD
+};
+
+struct ArchiveFileHeader
+{
+	char magic[8];	//ARCHIVE_MAGIC
+	uint32_t version;
+	uint32_t compression;	//ArchiveCompression
+	uint64_t createdNs;	//wall clock when the archive was opened, nanoseconds since the epoch
+	uint64_t reserved;
+};
+
+struct ArchiveFrameHeader
+{
+	char magic[4];	//ARCHIVE_FRAME_MAGIC
+	uint32_t packets;
+	uint32_t rawLength;	//bytes of the packets once decompressed
+	uint32_t compressedLength;	//bytes that follow this header, rawLength if stored uncompressed
+	uint64_t startNs;	//earliest and latest capture time of the packets of the frame
+	uint64_t endNs;
+};
+
+/*in front of every packet inside a decompressed frame*/
+struct ArchivePacketHeader
+{
+	uint64_t timestampNs;	//capture time, nanoseconds since the epoch
+	uint16_t length;	//bytes of UDP payload that follow
+	uint16_t dstPort;
+	uint8_t sensor;
+	uint8_t reserved[3];
+};
+
+struct ArchiveIndexEntry
+{
+	uint64_t offset;	//of the frame header from the start of the file
+	uint64_t startNs;
+	uint64_t endNs;
+	uint32_t packets;
+	uint32_t compressedLength;
+};
+
+struct ArchiveTrailer
+{
+	uint64_t indexOffset;
+	uint32_t frames;
+	uint32_t reserved;
+	char magic[8];	//ARCHIVE_TRAILER_MAGIC
+};
+
+/*Archives packets from the capture thread.
+AddPacket copies the payload into the frame being filled; a full frame is handed through a lock-free queue to a worker
+thread that compresses and writes it. the capture never waits for the worker: when every frame of the pool is still
+with it, the frame just filled is dropped and counted instead.*/
+class PacketArchiveWriter
+{
+public:
+	PacketArchiveWriter();
+	~PacketArchiveWriter();
+
+	/*creates the file and starts the worker. returns false and fills errbuf (CAPTURE_ERRBUF_SIZE bytes) if it cannot
+	be created or the compression is not compiled in.*/
+	bool Open(const char *path, ArchiveCompression compression, char *errbuf);
+	/*capture thread: archives the UDP payload of a packet*/
+	void AddPacket(const unsigned char *payload, unsigned int len, uint64_t timestampNs, unsigned short dstPort,
+		unsigned int sensor);
+	/*hands over the last frame, waits for the worker and writes the index and the trailer*/
+	bool Close(char *errbuf);
+
+	/*prints the packets archived and dropped and the compression ratio*/
+	void PrintStats(FILE *out) const;
+
+private:
+	struct Frame
+	{
+		std::vector<uint8_t> raw;	//ARCHIVE_FRAME_BYTES
+		std::vector<uint8_t> compressed;
+		ArchiveFrameHeader header;
+	};
+
+	/*hands the frame being filled to the worker, or drops it if the pool is empty. with last set it waits for the
+	worker instead.*/
+	void Submit(bool last = false);
+	/*worker side: compresses a frame and writes it*/
+	void WriteFrame(Frame &frame);
+	/*compresses a frame into frame.compressed and fills in its header*/
+	void Compress(Frame &frame);
+	bool WriteAll(const void *data, size_t len);
+
+	int fd;
+	std::string path;
+	ArchiveCompression compression;
+	std::vector<Frame *> frames;	//owns the buffers
+	BufferPool<Frame> pool;
+	void *context;	//of the compressor, used by the worker
+
+	/*capture thread statistics*/
+	uint64_t packets;
+	uint64_t droppedFrames;
+	uint64_t droppedPackets;
+	/*worker state, only read by the capture thread after it joined the worker*/
+	uint64_t offset;	//file size so far
+	uint64_t rawBytes;
+	std::vector<ArchiveIndexEntry> index;
+	int writeError;	//errno of the first failed write, 0 if none
+
+	PacketArchiveWriter(const PacketArchiveWriter &);
+	PacketArchiveWriter &operator=(const PacketArchiveWriter &);
+};
+
+/*Reads an archive through a memory mapping, only the frames asked for are touched and decompressed.*/
+class PacketArchiveReader
+{
+public:
+	PacketArchiveReader();
+	~PacketArchiveReader();
+
+	/*maps the file and loads its index, rebuilding it from the frames if the archive was not closed. returns false
+	and fills errbuf (CAPTURE_ERRBUF_SIZE bytes) if the file is not an archive or its compression is not compiled in.*/
+	bool Open(const char *path, char *errbuf);
+	void Close();
+
+	size_t Frames() const;
+	const ArchiveIndexEntry &Index(size_t frame) const;
+	/*decompresses a frame into raw. returns false and fills errbuf if it is corrupt.*/
+	bool ReadFrame(size_t frame, std::vector<uint8_t> &raw, char *errbuf) const;
+
+	/*the packet at offset of a decompressed frame as a LAYER_UDP_PAYLOAD packet pointing into raw, and moves offset
+	to the next one. returns false at the end of the frame.*/
+	static bool GetPacket(const std::vector<uint8_t> &raw, size_t &offset, RawPacket &packet);
+
+private:
+	/*reads the index behind the frames, false if the archive has none or it does not match the file*/
+	bool LoadIndex();
+	/*builds the index by walking the frames from the start, up to the first incomplete one*/
+	void ScanFrames();
+	/*true if a whole frame starts at offset and ends before limit*/
+	bool ValidFrame(uint64_t offset, uint64_t limit) const;
+
+	int fd;
+	std::string path;
+	const unsigned char *map;
+	size_t mapSize;
+	ArchiveCompression compression;
+	std::vector<ArchiveIndexEntry> index;
+
+	PacketArchiveReader(const PacketArchiveReader &);
+	PacketArchiveReader &operator=(const PacketArchiveReader &);
+};
+
+#endif
@@ -0,0 +1,159 @@
+#include "packet_decoder.h"
+#include "block_simd.h"
+#include "byte_order.h"
+
+#include <string.h>
+
+#define ETHERNET_HEADER_LEN 14
+#define VLAN_TAG_LEN 4
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_VLAN 0x8100
+#define IP_PROTOCOL_UDP 17
+#define UDP_HEADER_LEN 8
+
+bool LocateUdpPayload(const RawPacket &packet, const unsigned char **payload, unsigned int *len, unsigned short *dstPort)
+{
+	const unsigned char *p = packet.data;
+	unsigned int left = packet.caplen;
+
+	if (packet.layer == LAYER_UDP_PAYLOAD)
+	{
+		*payload = p;
+		*len = left;
+		*dstPort = packet.dstPort;
+		return true;
+	}
+
+	if (left < ETHERNET_HEADER_LEN)
+		return false;
+	unsigned int etherType = LoadBE16(p + 12);
+	unsigned int offset = ETHERNET_HEADER_LEN;
+	if (etherType == ETHERTYPE_VLAN)
+	{
+		if (left < ETHERNET_HEADER_LEN + VLAN_TAG_LEN)
+			return false;
+		etherType = LoadBE16(p + 16);
+		offset += VLAN_TAG_LEN;
+	}
+	if (etherType != ETHERTYPE_IPV4 || left < offset + 20)
+		return false;
+
+	const unsigned char *ip = p + offset;
+	unsigned int ipHeaderLen = (ip[0] & 0x0f) * 4;
+	unsigned int ipTotalLen = LoadBE16(ip + 2);
+	bool fragment = ((ip[6] & 0x3f) | ip[7]) != 0;	//more fragments flag or a fragment offset
+	if ((ip[0] >> 4) != 4 || ipHeaderLen < 20 || ip[9] != IP_PROTOCOL_UDP || fragment)
+		return false;
+	offset += ipHeaderLen;
+	if (left < offset + UDP_HEADER_LEN)
+		return false;
+
+	const unsigned char *udp = p + offset;
+	unsigned int udpLen = LoadBE16(udp + 4);
+	if (udpLen < UDP_HEADER_LEN || udpLen > ipTotalLen - ipHeaderLen)
+		return false;
+	offset += UDP_HEADER_LEN;
+
+	/*a payload cut short by the snaplen is reported with the length that was captured*/
+	*payload = p + offset;
+	*len = udpLen - UDP_HEADER_LEN;
+	if (offset + *len > left)
+		*len = left - offset;
+	*dstPort = LoadBE16(udp + 2);
+	return true;
+}
+
+PacketKind ClassifyPayload(unsigned short dstPort, unsigned int len, unsigned short dataPort, unsigned short positionPort)
+{
+	if (dstPort == dataPort)
+		return (len == VELODYNE_DATA_PAYLOAD_LEN) ? PACKET_DATA : PACKET_MALFORMED;
+	if (dstPort == positionPort)
+		return (len == VELODYNE_POSITION_PAYLOAD_LEN) ? PACKET_POSITION : PACKET_MALFORMED;
+	return PACKET_UNKNOWN;
+}
+
+/*the part of the decoder that depends on the model, once the packet has been checked*/
+template <class Model>
+static void DecodeBlocks(const unsigned char *payload, DataPacket &packet)
+{
+	static_assert(Model::channels * Model::firingsPerBlock == CHANNELS_PER_BLOCK, "a block holds 32 returns");
+
+	for (int b = 0; b < BLOCKS_PER_PACKET; b++)
+	{
+		const unsigned char *block = payload + b * BLOCK_LEN;
+		DataBlock &out = packet.blocks[b];
+
+		out.azimuth = LoadLE16(block + BLOCK_FLAG_LEN);
+		DeinterleaveBlock(block + BLOCK_FLAG_LEN + BLOCK_AZIMUTH_LEN, out.distance, out.reflectivity,
+			Model::distanceResolutionMm);
+	}
+}
+
+/*clears the strongest returns that are copies of the last return of the same firing, in place. the sensor reports
+the same echo in both blocks when the strongest return is also the last one.*/
+static void DropDuplicateReturns(DataPacket &packet)
+{
+	for (int f = 0; f < packet.firings; f++)
+	{
+		const DataBlock &last = packet.blocks[2 * f + RETURN_INDEX_LAST];
+		DataBlock &strongest = packet.blocks[2 * f + RETURN_INDEX_STRONGEST];
+
+		for (int c = 0; c < CHANNELS_PER_BLOCK; c++)
+		{
+			bool same = strongest.distance[c] == last.distance[c] && strongest.reflectivity[c] == last.reflectivity[c];
+			strongest.distance[c] = same ? 0 : strongest.distance[c];
+			strongest.reflectivity[c] = same ? 0 : strongest.reflectivity[c];
+		}
+	}
+}
+
+DecodeResult DecodeDataPacket(const unsigned char *payload, unsigned int len, DataPacket &packet)
+{
+	if (len != VELODYNE_DATA_PAYLOAD_LEN)
+		return DECODE_BAD_LENGTH;
+
+	for (int b = 0; b < BLOCKS_PER_PACKET; b++)
+	{
+		const unsigned char *block = payload + b * BLOCK_LEN;
+		if (block[0] != 0xFF || block[1] != 0xEE)
+			return DECODE_BAD_FLAG;
+	}
+
+	SensorModelId model = SensorModelFromProductId(payload[PRODUCT_ID_OFFSET]);
+	switch (model)
+	{
+	case SENSOR_VLP16:
+		DecodeBlocks<Vlp16>(payload, packet);
+		break;
+	case SENSOR_VLP32C:
+		DecodeBlocks<Vlp32c>(payload, packet);
+		break;
+	case SENSOR_HDL32E:
+		DecodeBlocks<Hdl32e>(payload, packet);
+		break;
+	default:
+		return DECODE_UNKNOWN_SENSOR;
+	}
+
+	packet.timestamp = LoadLE32(payload + TIMESTAMP_OFFSET);
+	packet.returnMode = payload[RETURN_MODE_OFFSET];
+	packet.productId = payload[PRODUCT_ID_OFFSET];
+	packet.model = model;
+	packet.returnsPerFiring = (packet.returnMode == RETURN_MODE_DUAL) ? 2 : 1;
+	packet.firings = BLOCKS_PER_PACKET / packet.returnsPerFiring;
+	if (packet.returnsPerFiring == 2)
+		DropDuplicateReturns(packet);
+	return DECODE_OK;
+}
+
+DecodeResult DecodePositionPacket(const unsigned char *payload, unsigned int len, PositionPacket &packet)
+{
+	if (len != VELODYNE_POSITION_PAYLOAD_LEN)
+		return DECODE_BAD_LENGTH;
+
+	const char *nmea = (const char *)payload + POSITION_NMEA_OFFSET;
+	packet.timestamp = LoadLE32(payload + POSITION_TIMESTAMP_OFFSET);
+	packet.nmea = nmea;
+	packet.nmeaLen = (unsigned int)strnlen(nmea, POSITION_NMEA_LEN);
+	return DECODE_OK;
+}
@@ -0,0 +1,104 @@
+#ifndef PACKET_DECODER_H
+#define PACKET_DECODER_H
+
+#include <stdint.h>
+#include "capture.h"
+#include "sensor_model.h"
+
+/*layout of a data packet: 12 blocks of [0xFFEE flag, azimuth, 32 x (distance, reflectivity)], then a four byte
+timestamp and the two factory bytes (return mode, product id)*/
+#define BLOCKS_PER_PACKET 12
+#define CHANNELS_PER_BLOCK 32
+#define BLOCK_LEN 100
+#define BLOCK_FLAG_LEN 2
+#define BLOCK_AZIMUTH_LEN 2
+#define RETURN_LEN 3
+#define TIMESTAMP_OFFSET (BLOCKS_PER_PACKET * BLOCK_LEN)
+#define RETURN_MODE_OFFSET (TIMESTAMP_OFFSET + 4)
+#define PRODUCT_ID_OFFSET (RETURN_MODE_OFFSET + 1)
+/*values of the return mode byte*/
+#define RETURN_MODE_STRONGEST 0x37
+#define RETURN_MODE_LAST 0x38
+#define RETURN_MODE_DUAL 0x39
+/*layout of a position packet: the same microseconds past the hour timestamp as the data packets, then the NMEA
+sentence of the GPS receiver, padded with zeros to the end of the packet*/
+#define POSITION_TIMESTAMP_OFFSET 198
+#define POSITION_NMEA_OFFSET 206
+#define POSITION_NMEA_LEN (VELODYNE_POSITION_PAYLOAD_LEN - POSITION_NMEA_OFFSET)
+
+/*one decoded block, stored as separate arrays per field so later stages can work on all 32 channels at once. 16 byte
+alignment is what new and the standard containers guarantee before C++17.*/
+struct DataBlock
+{
+	alignas(16) uint32_t distance[CHANNELS_PER_BLOCK];	//millimeters, 0 is no return
+	alignas(16) uint8_t reflectivity[CHANNELS_PER_BLOCK];
+	uint16_t azimuth;	//hundredths of a degree
+};
+
+/*one decoded data packet. in dual return mode the sensor sends each firing twice, as a pair of blocks with the
+same azimuth: the last return in the even block and the strongest in the odd one. the pairs are left where they
+are, return r of firing f is blocks[f * returnsPerFiring + r] (see FiringReturn).*/
+struct DataPacket
+{
+	DataBlock blocks[BLOCKS_PER_PACKET];
+	uint32_t timestamp;	//microseconds past the hour
+	uint8_t returnMode;
+	uint8_t productId;
+	SensorModelId model;	//decoded from productId, distances are already scaled by its resolution
+	int returnsPerFiring;	//2 in dual return mode, otherwise 1
+	int firings;	//number of distinct firings, BLOCKS_PER_PACKET / returnsPerFiring
+};
+
+/*return index of the last and strongest returns of a firing in dual return mode*/
+#define RETURN_INDEX_LAST 0
+#define RETURN_INDEX_STRONGEST 1
+
+/*return r of firing f of a decoded packet*/
+inline const DataBlock &FiringReturn(const DataPacket &packet, int f, int r)
+{
+	return packet.blocks[f * packet.returnsPerFiring + r];
+}
+
+/*one decoded position packet. nmea points into the payload it was decoded from.*/
+struct PositionPacket
+{
+	uint32_t timestamp;	//microseconds past the hour
+	const char *nmea;	//sentence without the zero padding, not terminated
+	unsigned int nmeaLen;
+};
+
+/*what a UDP payload is, decided from its destination port and length before any of it is parsed*/
+enum PacketKind
+{
+	PACKET_DATA,
+	PACKET_POSITION,
+	PACKET_UNKNOWN,	//not sent to one of the sensor's ports, or not UDP at all
+	PACKET_MALFORMED	//sent to a sensor port but with the wrong length or contents
+};
+
+enum DecodeResult
+{
+	DECODE_OK,
+	DECODE_BAD_LENGTH,	//payload is not VELODYNE_DATA_PAYLOAD_LEN bytes
+	DECODE_BAD_FLAG,	//a block does not start with 0xFFEE
+	DECODE_UNKNOWN_SENSOR	//the product id is not one of the models in sensor_model.h
+};
+
+/*finds the UDP payload of a captured packet. Ethernet frames are parsed through an optional VLAN tag and the IPv4
+header; payloads from the socket backends are passed through. returns false for anything that is not unfragmented
+UDP over IPv4 or is cut short.*/
+bool LocateUdpPayload(const RawPacket &packet, const unsigned char **payload, unsigned int *len, unsigned short *dstPort);
+
+/*classifies a UDP payload sent to dstPort for a sensor that uses the given data and position ports*/
+PacketKind ClassifyPayload(unsigned short dstPort, unsigned int len, unsigned short dataPort, unsigned short positionPort);
+
+/*decodes a whole data packet payload by fixed offsets into packet, with the decoder instantiated for the model
+named by its product id. the length, all block flags and the product id are checked up front, so a packet is either
+decoded completely or not at all. in dual return mode a strongest return that is the same as the last return of the
+firing is cleared (distance and reflectivity 0), so every echo is only reported once.*/
+DecodeResult DecodeDataPacket(const unsigned char *payload, unsigned int len, DataPacket &packet);
+
+/*decodes a position packet payload into packet. only the length is checked, the sentence is not validated.*/
+DecodeResult DecodePositionPacket(const unsigned char *payload, unsigned int len, PositionPacket &packet);
+
+#endif
@@ -0,0 +1,95 @@
+#include "pcap_capture.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "capture.h"
+
+/*read timeout of live captures in milliseconds*/
+#define SENSOR_READ_TIMEOUT 20
+
+/*longest filter expression, with both ports five digits long*/
+#define SENSOR_FILTER_LEN 128
+
+/*builds the filter expression that passes the sensor's data and position packets, untagged or behind one 802.1Q tag.
+"vlan" moves the offsets of everything after it by the tag, so the tagged case is a second test of its own.*/
+static void SensorFilterExpression(unsigned short dataPort, unsigned short positionPort, char *expr, size_t len)
+{
+	snprintf(expr, len, "(udp and (dst port %u or dst port %u)) or (vlan and udp and (dst port %u or dst port %u))",
+		dataPort, positionPort, dataPort, positionPort);
+}
+
+pcap_t *OpenSensorCapture(const char *device, unsigned short dataPort, unsigned short positionPort, char *errbuf,
+	int bufferBytes)
+{
+	pcap_t *fp;
+	struct bpf_program program;
+	char expr[SENSOR_FILTER_LEN];
+	int status;
+
+	if ((fp = pcap_create(device, errbuf)) == NULL)
+		return NULL;
+
+	/*the options have to be set before the handle is activated*/
+	pcap_set_snaplen(fp, SENSOR_SNAPLEN);
+	pcap_set_promisc(fp, 1);
+	pcap_set_timeout(fp, SENSOR_READ_TIMEOUT);
+	pcap_set_buffer_size(fp, bufferBytes);
+
+	status = pcap_activate(fp);
+	if (status < 0)
+	{
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s: %s (%s)", device, pcap_statustostr(status), pcap_geterr(fp));
+		pcap_close(fp);
+		return NULL;
+	}
+	if (status > 0)
+		fprintf(stderr, "Warning opening %s: %s (%s)\n", device, pcap_statustostr(status), pcap_geterr(fp));
+
+	if (pcap_datalink(fp) != DLT_EN10MB)
+	{
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s is not an Ethernet device", device);
+		pcap_close(fp);
+		return NULL;
+	}
+
+	SensorFilterExpression(dataPort, positionPort, expr, sizeof(expr));
+	if (pcap_compile(fp, &program, expr, 1, PCAP_NETMASK_UNKNOWN) < 0)
+	{
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "compiling \"%s\": %s", expr, pcap_geterr(fp));
+		pcap_close(fp);
+		return NULL;
+	}
+	if (pcap_setfilter(fp, &program) < 0)
+	{
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "installing \"%s\": %s", expr, pcap_geterr(fp));
+		pcap_freecode(&program);
+		pcap_close(fp);
+		return NULL;
+	}
+	pcap_freecode(&program);
+
+	return fp;
+}
+
+bool CompileSensorFilter(unsigned short dataPort, unsigned short positionPort, struct bpf_program *program,
+	char *errbuf)
+{
+	char expr[SENSOR_FILTER_LEN];
+	pcap_t *dead = pcap_open_dead(DLT_EN10MB, SENSOR_SNAPLEN);
+
+	if (dead == NULL)
+	{
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "pcap_open_dead failed");
+		return false;
+	}
+
+	SensorFilterExpression(dataPort, positionPort, expr, sizeof(expr));
+	if (pcap_compile(dead, program, expr, 1, PCAP_NETMASK_UNKNOWN) < 0)
+	{
+		snprintf(errbuf, PCAP_ERRBUF_SIZE, "compiling \"%s\": %s", expr, pcap_geterr(dead));
+		pcap_close(dead);
+		return false;
+	}
+	pcap_close(dead);
+	return true;
+}
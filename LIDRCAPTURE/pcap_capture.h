@@ -0,0 +1,20 @@
+#ifndef PCAP_CAPTURE_H
+#define PCAP_CAPTURE_H
+
+#include <pcap.h>
+
+/*kernel capture buffer requested for live captures*/
+#define SENSOR_CAPTURE_BUFFER (32 << 20)
+
+/*opens device for capturing the sensor: the snaplen holds a whole data packet frame, the kernel buffer is enlarged
+to bufferBytes and a compiled BPF filter drops everything but the sensor's UDP ports inside the kernel, before
+anything is copied to us. returns NULL and fills errbuf (PCAP_ERRBUF_SIZE bytes) on failure.*/
+pcap_t *OpenSensorCapture(const char *device, unsigned short dataPort, unsigned short positionPort, char *errbuf,
+	int bufferBytes = SENSOR_CAPTURE_BUFFER);
+
+/*compiles the sensor filter for an Ethernet capture without needing an open device, for backends that attach
+the program to their own socket. free it with pcap_freecode. returns false and fills errbuf on failure.*/
+bool CompileSensorFilter(unsigned short dataPort, unsigned short positionPort, struct bpf_program *program,
+	char *errbuf);
+
+#endif
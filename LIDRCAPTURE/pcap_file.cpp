@@ -0,0 +1,357 @@
+#include "pcap_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*classic pcap magic numbers for microsecond and nanosecond timestamps*/
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define PCAP_FILE_HEADER_LEN 24
+#define PCAP_RECORD_HEADER_LEN 16
+
+/*pcapng block types and the section header byte order magic*/
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_SPB 0x00000003
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+/*interface description block options we understand*/
+#define PCAPNG_OPT_END 0
+#define PCAPNG_IF_TSRESOL 9
+#define PCAPNG_IF_TSOFFSET 14
+
+#define LINKTYPE_ETHERNET 1
+
+static uint64_t MonotonicNs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+PcapFileReader::PcapFileReader()
+	: fd(-1), map(NULL), mapSize(0), pcapng(false), swapped(false), stop(NULL), speed(0), started(false),
+	firstPacketNs(0), startWallNs(0), packets(0), bytes(0), skipped(0), elapsedNs(0)
+{
+}
+
+PcapFileReader::~PcapFileReader()
+{
+	Close();
+}
+
+uint16_t PcapFileReader::Read16(const unsigned char *p) const
+{
+	uint16_t v;
+	memcpy(&v, p, sizeof(v));
+	return swapped ? __builtin_bswap16(v) : v;
+}
+
+uint32_t PcapFileReader::Read32(const unsigned char *p) const
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return swapped ? __builtin_bswap32(v) : v;
+}
+
+bool PcapFileReader::Open(const char *path, char *errbuf)
+{
+	struct stat st;
+	uint32_t magic;
+
+	Close();
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path, strerror(errno));
+		Close();
+		return false;
+	}
+	if (st.st_size < PCAP_FILE_HEADER_LEN)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: too short for a capture file", path);
+		Close();
+		return false;
+	}
+
+	mapSize = (size_t)st.st_size;
+	void *mem = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	if (mem == MAP_FAILED)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "mmap of %s: %s", path, strerror(errno));
+		mapSize = 0;
+		Close();
+		return false;
+	}
+	map = (const unsigned char *)mem;
+	madvise(mem, mapSize, MADV_SEQUENTIAL);
+
+	memcpy(&magic, map, sizeof(magic));
+	if (magic == PCAPNG_SHB)
+	{
+		/*the byte order of a pcapng section is given by the magic inside its header*/
+		pcapng = true;
+		memcpy(&magic, map + 8, sizeof(magic));
+		if (magic == PCAPNG_BYTE_ORDER_MAGIC)
+			swapped = false;
+		else if (__builtin_bswap32(magic) == PCAPNG_BYTE_ORDER_MAGIC)
+			swapped = true;
+		else
+		{
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: bad pcapng byte order magic", path);
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	Interface iface;
+	iface.offsetSeconds = 0;
+	if (magic == PCAP_MAGIC_US || magic == PCAP_MAGIC_NS)
+		swapped = false;
+	else if (__builtin_bswap32(magic) == PCAP_MAGIC_US || __builtin_bswap32(magic) == PCAP_MAGIC_NS)
+	{
+		swapped = true;
+		magic = __builtin_bswap32(magic);
+	}
+	else
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: not a pcap or pcapng file", path);
+		Close();
+		return false;
+	}
+	iface.unitsPerSecond = (magic == PCAP_MAGIC_NS) ? 1000000000ULL : 1000000ULL;
+	iface.linkType = Read32(map + 20) & 0xffff;	//the upper bits of the network field carry FCS information
+	interfaces.push_back(iface);
+	return true;
+}
+
+int PcapFileReader::Run(PacketHandler handler, void *user, double speed, char *errbuf, const std::atomic<bool> *stop)
+{
+	this->stop = stop;
+	this->speed = speed;
+	started = false;
+
+	uint64_t begin = MonotonicNs();
+	int res = pcapng ? RunPcapng(handler, user, errbuf) : RunPcap(handler, user, errbuf);
+	elapsedNs += MonotonicNs() - begin;
+	return res;
+}
+
+int PcapFileReader::RunPcap(PacketHandler handler, void *user, char *errbuf)
+{
+	size_t offset = PCAP_FILE_HEADER_LEN;
+	RawPacket packet;
+
+	while (offset + PCAP_RECORD_HEADER_LEN <= mapSize && !Stopped())
+	{
+		const unsigned char *rec = map + offset;
+		uint32_t caplen = Read32(rec + 8);
+
+		if (offset + PCAP_RECORD_HEADER_LEN + caplen > mapSize)
+		{
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "record at offset %zu runs past the end of the file", offset);
+			return -1;
+		}
+
+		uint64_t ts = (uint64_t)Read32(rec) * interfaces[0].unitsPerSecond + Read32(rec + 4);
+		packet.timestampNs = ToNanoseconds(ts, interfaces[0]);
+		packet.data = rec + PCAP_RECORD_HEADER_LEN;
+		packet.caplen = caplen;
+		packet.len = Read32(rec + 12);
+		Deliver(packet, interfaces[0].linkType, handler, user);
+
+		offset += PCAP_RECORD_HEADER_LEN + caplen;
+	}
+	return 0;
+}
+
+int PcapFileReader::RunPcapng(PacketHandler handler, void *user, char *errbuf)
+{
+	size_t offset = 0;
+	uint64_t lastNs = 0;
+	RawPacket packet;
+
+	while (offset + 12 <= mapSize && !Stopped())
+	{
+		const unsigned char *block = map + offset;
+		uint32_t type;
+		memcpy(&type, block, sizeof(type));
+
+		/*a new section can switch byte order and starts a new list of interfaces*/
+		if (type == PCAPNG_SHB)
+		{
+			uint32_t magic;
+			memcpy(&magic, block + 8, sizeof(magic));
+			swapped = (magic != PCAPNG_BYTE_ORDER_MAGIC);
+			interfaces.clear();
+		}
+		else
+			type = Read32(block);
+
+		uint32_t blockLen = Read32(block + 4);
+		if (blockLen < 12 || (blockLen & 3) != 0 || offset + blockLen > mapSize)
+		{
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "bad pcapng block length %u at offset %zu", blockLen, offset);
+			return -1;
+		}
+		const unsigned char *body = block + 8;
+		size_t bodyLen = blockLen - 12;
+
+		if (type == PCAPNG_IDB && bodyLen >= 8)
+			AddInterface(body, bodyLen);
+		else if (type == PCAPNG_EPB && bodyLen >= 20)
+		{
+			uint32_t ifaceId = Read32(body);
+			uint32_t caplen = Read32(body + 12);
+
+			if (ifaceId >= interfaces.size() || 20 + (size_t)caplen > bodyLen)
+			{
+				snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "bad enhanced packet block at offset %zu", offset);
+				return -1;
+			}
+			uint64_t ts = ((uint64_t)Read32(body + 4) << 32) | Read32(body + 8);
+			packet.timestampNs = lastNs = ToNanoseconds(ts, interfaces[ifaceId]);
+			packet.data = body + 20;
+			packet.caplen = caplen;
+			packet.len = Read32(body + 16);
+			Deliver(packet, interfaces[ifaceId].linkType, handler, user);
+		}
+		else if (type == PCAPNG_SPB && bodyLen >= 4 && !interfaces.empty())
+		{
+			/*simple packet blocks have no timestamp, keep the time of the previous packet*/
+			packet.len = Read32(body);
+			packet.caplen = (packet.len < bodyLen - 4) ? packet.len : (unsigned int)(bodyLen - 4);
+			packet.data = body + 4;
+			packet.timestampNs = lastNs;
+			Deliver(packet, interfaces[0].linkType, handler, user);
+		}
+
+		offset += blockLen;
+	}
+	return 0;
+}
+
+void PcapFileReader::AddInterface(const unsigned char *body, size_t bodyLen)
+{
+	Interface iface;
+	size_t opt = 8;
+
+	iface.linkType = Read16(body);
+	iface.unitsPerSecond = 1000000;
+	iface.offsetSeconds = 0;
+
+	while (opt + 4 <= bodyLen)
+	{
+		uint16_t code = Read16(body + opt);
+		uint16_t len = Read16(body + opt + 2);
+
+		if (code == PCAPNG_OPT_END || opt + 4 + len > bodyLen)
+			break;
+		if (code == PCAPNG_IF_TSRESOL && len >= 1)
+		{
+			/*high bit set: negative power of two, otherwise negative power of ten*/
+			unsigned char resol = body[opt + 4];
+			unsigned int exponent = resol & 0x7f;
+			uint64_t units = 1;
+
+			for (unsigned int e = 0; e < exponent && units < 1000000000000000000ULL; e++)
+				units *= (resol & 0x80) ? 2 : 10;
+			iface.unitsPerSecond = units;
+		}
+		else if (code == PCAPNG_IF_TSOFFSET && len >= 8)
+		{
+			uint64_t v;
+			memcpy(&v, body + opt + 4, sizeof(v));
+			iface.offsetSeconds = (int64_t)(swapped ? __builtin_bswap64(v) : v);
+		}
+		opt += 4 + ((len + 3) & ~3u);
+	}
+
+	interfaces.push_back(iface);
+}
+
+uint64_t PcapFileReader::ToNanoseconds(uint64_t ts, const Interface &iface)
+{
+	uint64_t seconds = ts / iface.unitsPerSecond;
+	uint64_t fraction = ts % iface.unitsPerSecond;
+
+	/*multiplied before dividing, a power of two resolution does not divide a second evenly. the 128 bit product
+	cannot overflow at any resolution the option can give.*/
+	uint64_t ns = (uint64_t)((unsigned __int128)fraction * 1000000000ULL / iface.unitsPerSecond);
+	return (seconds + iface.offsetSeconds) * 1000000000ULL + ns;
+}
+
+bool PcapFileReader::Stopped() const
+{
+	return stop != NULL && stop->load(std::memory_order_relaxed);
+}
+
+void PcapFileReader::Deliver(RawPacket &packet, unsigned int linkType, PacketHandler handler, void *user)
+{
+	if (linkType != LINKTYPE_ETHERNET)
+	{
+		skipped++;
+		return;
+	}
+
+	if (speed > 0)
+	{
+		if (!started)
+		{
+			started = true;
+			firstPacketNs = packet.timestampNs;
+			startWallNs = MonotonicNs();
+		}
+		else if (packet.timestampNs > firstPacketNs)
+		{
+			/*sleep until the packet is due relative to the first one, absolute deadlines do not accumulate drift*/
+			uint64_t due = startWallNs + (uint64_t)((packet.timestampNs - firstPacketNs) / speed);
+			struct timespec deadline;
+			deadline.tv_sec = due / 1000000000ULL;
+			deadline.tv_nsec = due % 1000000000ULL;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR && !Stopped())
+				;
+		}
+	}
+
+	packet.layer = LAYER_ETHERNET;
+	packet.dstPort = 0;
+	packet.sensor = 0;
+	handler(packet, user);
+	packets++;
+	bytes += packet.caplen;
+}
+
+void PcapFileReader::PrintStats(FILE *out)
+{
+	double seconds = elapsedNs / 1e9;
+
+	fprintf(out, "replay: %llu packets, %llu bytes in %.3f s (%.0f packets/s, %.1f MB/s), %llu non-Ethernet packets skipped\n",
+		(unsigned long long)packets, (unsigned long long)bytes, seconds, seconds > 0 ? packets / seconds : 0.0,
+		seconds > 0 ? bytes / seconds / 1e6 : 0.0, (unsigned long long)skipped);
+}
+
+void PcapFileReader::Close()
+{
+	if (map != NULL)
+	{
+		munmap((void *)map, mapSize);
+		map = NULL;
+		mapSize = 0;
+	}
+	if (fd >= 0)
+	{
+		close(fd);
+		fd = -1;
+	}
+	interfaces.clear();
+	pcapng = false;
+	swapped = false;
+}
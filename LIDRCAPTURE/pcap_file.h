@@ -0,0 +1,75 @@
+#ifndef PCAP_FILE_H
+#define PCAP_FILE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include "capture.h"
+
+/*Offline source that replays a recorded .pcap or .pcapng file.
+The file is memory mapped and the records are walked in place, every packet is handed to the decoder straight
+out of the mapping without going through libpcap. Replay either runs as fast as the decoder can take the packets
+or is paced by the recorded timestamps, at real time or any multiple of it.*/
+class PcapFileReader
+{
+public:
+	PcapFileReader();
+	~PcapFileReader();
+
+	/*maps the file and checks its header. returns false and fills errbuf (CAPTURE_ERRBUF_SIZE bytes) on failure.*/
+	bool Open(const char *path, char *errbuf);
+	/*calls handler for every Ethernet packet in the file. speed 0 replays as fast as possible, 1 in real time and
+	N at N times real time. returns 0 at the end of the file or once stop is set and -1 with errbuf filled in if the
+	file is corrupt.*/
+	int Run(PacketHandler handler, void *user, double speed, char *errbuf, const std::atomic<bool> *stop = NULL);
+	/*prints packet counts and the replay throughput*/
+	void PrintStats(FILE *out);
+	void Close();
+
+private:
+	/*what we need to know about one pcapng interface*/
+	struct Interface
+	{
+		unsigned int linkType;
+		uint64_t unitsPerSecond;	//timestamp resolution
+		int64_t offsetSeconds;	//if_tsoffset
+	};
+
+	int RunPcap(PacketHandler handler, void *user, char *errbuf);
+	int RunPcapng(PacketHandler handler, void *user, char *errbuf);
+	/*parses an interface description block body*/
+	void AddInterface(const unsigned char *body, size_t bodyLen);
+	/*converts a timestamp in units of the interface resolution to nanoseconds since the epoch*/
+	static uint64_t ToNanoseconds(uint64_t ts, const Interface &iface);
+	/*true once the stop flag given to Run is set*/
+	bool Stopped() const;
+	/*sleeps until the packet is due and hands it to the handler*/
+	void Deliver(RawPacket &packet, unsigned int linkType, PacketHandler handler, void *user);
+
+	uint16_t Read16(const unsigned char *p) const;
+	uint32_t Read32(const unsigned char *p) const;
+
+	int fd;
+	const unsigned char *map;
+	size_t mapSize;
+	bool pcapng;
+	bool swapped;	//file was written on a machine with the other byte order
+	std::vector<Interface> interfaces;
+
+	const std::atomic<bool> *stop;
+
+	/*pacing*/
+	double speed;
+	bool started;
+	uint64_t firstPacketNs;
+	uint64_t startWallNs;
+
+	/*statistics*/
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t skipped;	//packets with a link type other than Ethernet
+	uint64_t elapsedNs;
+};
+
+#endif
@@ -0,0 +1,302 @@
+#include "pcapng_tee.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include "buffer_pool.h"
+
+/*pcapng block types, options and the byte order magic, as read back by PcapFileReader*/
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPT_END 0
+#define PCAPNG_SHB_USERAPPL 4
+#define PCAPNG_IF_NAME 2
+#define PCAPNG_IF_DESCRIPTION 3
+#define PCAPNG_IF_TSRESOL 9
+#define LINKTYPE_ETHERNET 1
+#define PCAPNG_SNAPLEN 65535
+/*block type, block length, interface, timestamp high and low, captured and original length*/
+#define PCAPNG_EPB_HEADER_LEN 28
+
+/*Ethernet, IPv4 without options and UDP header put in front of a bare UDP payload*/
+#define SYNTHETIC_HEADER_LEN (14 + 20 + 8)
+/*made up addresses of a payload-only frame: the vendor prefix of the sensors and their factory IP, plus the sensor
+number, sending to broadcast as they do out of the box*/
+static const uint8_t SENSOR_MAC[6] = { 0x60, 0x76, 0x88, 0x00, 0x00, 0x00 };
+static const uint8_t SENSOR_IP[4] = { 192, 168, 1, 201 };
+
+static void Put16(std::vector<uint8_t> &block, uint16_t v)
+{
+	block.insert(block.end(), (const uint8_t *)&v, (const uint8_t *)&v + sizeof(v));
+}
+
+static void Put32(std::vector<uint8_t> &block, uint32_t v)
+{
+	block.insert(block.end(), (const uint8_t *)&v, (const uint8_t *)&v + sizeof(v));
+}
+
+/*appends an option padded to 4 bytes*/
+static void PutOption(std::vector<uint8_t> &block, uint16_t code, const void *data, size_t len)
+{
+	Put16(block, code);
+	Put16(block, (uint16_t)len);
+	block.insert(block.end(), (const uint8_t *)data, (const uint8_t *)data + len);
+	block.resize((block.size() + 3) & ~(size_t)3, 0);
+}
+
+/*fills in the block length at both ends of a block that has room for the trailing one*/
+static void FinishBlock(std::vector<uint8_t> &block)
+{
+	Put32(block, 0);
+	uint32_t len = (uint32_t)block.size();
+	memcpy(&block[4], &len, sizeof(len));
+	memcpy(&block[block.size() - 4], &len, sizeof(len));
+}
+
+/*the frame headers in front of a UDP payload of len bytes sent to dstPort by sensor*/
+static void SyntheticHeader(uint8_t *h, unsigned int len, unsigned short dstPort, unsigned int sensor)
+{
+	uint16_t ipLen = (uint16_t)(20 + 8 + len);
+	uint16_t udpLen = (uint16_t)(8 + len);
+
+	memset(h, 0xff, 6);	//broadcast
+	memcpy(h + 6, SENSOR_MAC, 6);
+	h[11] = (uint8_t)sensor;
+	h[12] = 0x08;	//IPv4
+	h[13] = 0x00;
+
+	uint8_t *ip = h + 14;
+	memset(ip, 0, 20);
+	ip[0] = 0x45;
+	ip[2] = (uint8_t)(ipLen >> 8);
+	ip[3] = (uint8_t)ipLen;
+	ip[6] = 0x40;	//don't fragment
+	ip[8] = 64;	//ttl
+	ip[9] = 17;	//UDP
+	memcpy(ip + 12, SENSOR_IP, 4);
+	ip[15] = (uint8_t)(SENSOR_IP[3] + sensor);
+	memset(ip + 16, 0xff, 4);
+	uint32_t sum = 0;
+	for (int i = 0; i < 20; i += 2)
+		sum += (uint32_t)ip[i] << 8 | ip[i + 1];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	ip[10] = (uint8_t)(~sum >> 8);
+	ip[11] = (uint8_t)~sum;
+
+	/*the sensors send from the port they send to, the checksum is left out as IPv4 allows*/
+	uint8_t *udp = ip + 20;
+	udp[0] = udp[2] = (uint8_t)(dstPort >> 8);
+	udp[1] = udp[3] = (uint8_t)dstPort;
+	udp[4] = (uint8_t)(udpLen >> 8);
+	udp[5] = (uint8_t)udpLen;
+	udp[6] = udp[7] = 0;
+}
+
+PcapngTee::PcapngTee()
+	: fd(-1), interfaces(0), stopping(false), head(0), tail(0), packets(0), droppedPackets(0), highWater(0),
+	writtenBytes(0), writeError(0)
+{
+}
+
+PcapngTee::~PcapngTee()
+{
+	char errbuf[CAPTURE_ERRBUF_SIZE];
+
+	if (fd >= 0)
+		Close(errbuf);
+}
+
+bool PcapngTee::WriteAll(const void *data, size_t len)
+{
+	const char *p = (const char *)data;
+
+	while (len > 0)
+	{
+		ssize_t n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+		{
+			if (writeError == 0)
+				writeError = errno;
+			return false;
+		}
+		p += n;
+		len -= n;
+		writtenBytes += n;
+	}
+	return true;
+}
+
+bool PcapngTee::Open(const char *path, const std::vector<PcapngInterface> &interfaces, char *errbuf)
+{
+	std::vector<uint8_t> blocks;
+	static const char application[] = "UAV_3D_Mapping";
+
+	this->path = path;
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path, strerror(errno));
+		return false;
+	}
+
+	/*section header: byte order magic, version 1.0, section length unknown*/
+	Put32(blocks, PCAPNG_SHB);
+	Put32(blocks, 0);
+	Put32(blocks, PCAPNG_BYTE_ORDER_MAGIC);
+	Put16(blocks, 1);
+	Put16(blocks, 0);
+	Put32(blocks, 0xffffffff);
+	Put32(blocks, 0xffffffff);
+	PutOption(blocks, PCAPNG_SHB_USERAPPL, application, strlen(application));
+	PutOption(blocks, PCAPNG_OPT_END, NULL, 0);
+	FinishBlock(blocks);
+
+	for (size_t i = 0; i < interfaces.size(); i++)
+	{
+		std::vector<uint8_t> block;
+		uint8_t resolution = 9;	//nanoseconds
+
+		Put32(block, PCAPNG_IDB);
+		Put32(block, 0);
+		Put16(block, LINKTYPE_ETHERNET);
+		Put16(block, 0);
+		Put32(block, PCAPNG_SNAPLEN);
+		PutOption(block, PCAPNG_IF_NAME, interfaces[i].name.data(), interfaces[i].name.size());
+		PutOption(block, PCAPNG_IF_DESCRIPTION, interfaces[i].description.data(), interfaces[i].description.size());
+		PutOption(block, PCAPNG_IF_TSRESOL, &resolution, 1);
+		PutOption(block, PCAPNG_OPT_END, NULL, 0);
+		FinishBlock(block);
+		blocks.insert(blocks.end(), block.begin(), block.end());
+	}
+
+	writeError = 0;
+	writtenBytes = 0;
+	if (!WriteAll(blocks.data(), blocks.size()))
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path, strerror(writeError));
+		close(fd);
+		fd = -1;
+		return false;
+	}
+
+	this->interfaces = interfaces.size();
+	ring.resize(PCAPNG_TEE_RING_BYTES);
+	head = 0;
+	tail = 0;
+	stopping = false;
+	writer = std::thread(&PcapngTee::Run, this);
+	return true;
+}
+
+void PcapngTee::Put(uint64_t pos, const void *data, size_t len)
+{
+	size_t start = (size_t)(pos % ring.size());
+	size_t first = (len < ring.size() - start) ? len : ring.size() - start;
+
+	memcpy(&ring[start], data, first);
+	memcpy(&ring[0], (const uint8_t *)data + first, len - first);
+}
+
+void PcapngTee::AddPacket(const RawPacket &packet)
+{
+	uint8_t synthetic[SYNTHETIC_HEADER_LEN];
+	size_t headerLen = (packet.layer == LAYER_UDP_PAYLOAD) ? SYNTHETIC_HEADER_LEN : 0;
+	size_t caplen = headerLen + packet.caplen;
+	size_t padding = ((caplen + 3) & ~(size_t)3) - caplen;
+	uint32_t blockLen = (uint32_t)(PCAPNG_EPB_HEADER_LEN + caplen + padding + 4);
+
+	if (fd < 0 || packet.sensor >= interfaces)
+		return;
+	uint64_t h = head.load(std::memory_order_relaxed);
+	uint64_t queued = h - tail.load(std::memory_order_acquire);
+	if (queued + blockLen > ring.size())
+	{
+		droppedPackets++;
+		return;
+	}
+
+	uint32_t epb[PCAPNG_EPB_HEADER_LEN / 4];
+	epb[0] = PCAPNG_EPB;
+	epb[1] = blockLen;
+	epb[2] = packet.sensor;
+	epb[3] = (uint32_t)(packet.timestampNs >> 32);
+	epb[4] = (uint32_t)packet.timestampNs;
+	epb[5] = (uint32_t)caplen;
+	epb[6] = (uint32_t)(headerLen + ((packet.layer == LAYER_UDP_PAYLOAD) ? packet.caplen : packet.len));
+	Put(h, epb, sizeof(epb));
+	h += sizeof(epb);
+	if (headerLen > 0)
+	{
+		SyntheticHeader(synthetic, packet.caplen, packet.dstPort, packet.sensor);
+		Put(h, synthetic, headerLen);
+		h += headerLen;
+	}
+	Put(h, packet.data, packet.caplen);
+	h += packet.caplen;
+
+	uint8_t trailer[8] = { 0 };
+	memcpy(trailer + padding, &blockLen, sizeof(blockLen));
+	Put(h, trailer, padding + 4);
+	h += padding + 4;
+
+	head.store(h, std::memory_order_release);
+	packets++;
+	if (queued + blockLen > highWater)
+		highWater = queued + blockLen;
+}
+
+void PcapngTee::Run()
+{
+	ConsumeUntilStopped(stopping, [this]()
+	{
+		uint64_t t = tail.load(std::memory_order_relaxed);
+		uint64_t h = head.load(std::memory_order_acquire);
+		if (h == t)
+			return false;
+
+		/*everything up to the end of the ring in one write, the rest on the next pass. after a failed write the
+		ring is still drained so the capture keeps going.*/
+		size_t start = (size_t)(t % ring.size());
+		size_t len = (h - t < ring.size() - start) ? (size_t)(h - t) : ring.size() - start;
+		if (writeError == 0)
+			WriteAll(&ring[start], len);
+		tail.store(t + len, std::memory_order_release);
+		return true;
+	});
+}
+
+bool PcapngTee::Close(char *errbuf)
+{
+	bool ok = true;
+
+	if (fd < 0)
+		return true;
+	stopping = true;
+	writer.join();
+
+	if (writeError != 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path.c_str(), strerror(writeError));
+		ok = false;
+	}
+	if (close(fd) < 0 && ok)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path.c_str(), strerror(errno));
+		ok = false;
+	}
+	fd = -1;
+	return ok;
+}
+
+void PcapngTee::PrintStats(FILE *out) const
+{
+	fprintf(out, "%s: %llu frames, %llu bytes, %llu frames dropped with the ring full, at most %llu of %zu ring bytes "
+		"used\n", path.c_str(), (unsigned long long)packets, (unsigned long long)writtenBytes,
+		(unsigned long long)droppedPackets, (unsigned long long)highWater, ring.size());
+}
@@ -0,0 +1,76 @@
+#ifndef PCAPNG_TEE_H
+#define PCAPNG_TEE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "capture.h"
+
+/*bytes of the ring between the capture thread and the writer, some seconds of several sensors*/
+#define PCAPNG_TEE_RING_BYTES (16 << 20)
+
+/*what the interface description block of one sensor says about it*/
+struct PcapngInterface
+{
+	std::string name;	//if_name, the capture device or backend
+	std::string description;	//if_description
+};
+
+/*Records the sensor frames the decoder accepts to a pcapng file, so the raw data of a flight survives a decode bug.
+there is one interface per sensor, numbered like RawPacket::sensor, with nanosecond timestamps (if_tsresol 9). frames
+from the socket backends, which only see the UDP payload, get an Ethernet, IPv4 and UDP header made up from the
+destination port and the sensor number. the capture thread only copies each frame as a finished enhanced packet block
+into a byte ring; a writer thread writes whatever the ring holds. when the ring is full the frame is dropped and
+counted, the capture never waits for the disk. the file replays with -r like any other pcapng file.*/
+class PcapngTee
+{
+public:
+	PcapngTee();
+	~PcapngTee();
+
+	/*creates the file, writes the section header and one interface per entry of interfaces and starts the writer.
+	returns false and fills errbuf (CAPTURE_ERRBUF_SIZE bytes) on failure.*/
+	bool Open(const char *path, const std::vector<PcapngInterface> &interfaces, char *errbuf);
+	/*capture thread: records a frame of the interface packet.sensor*/
+	void AddPacket(const RawPacket &packet);
+	/*writes what is left in the ring and closes the file*/
+	bool Close(char *errbuf);
+
+	/*prints the frames recorded and dropped and the fullest the ring got*/
+	void PrintStats(FILE *out) const;
+
+private:
+	/*copies len bytes into the ring at position pos, wrapping around its end*/
+	void Put(uint64_t pos, const void *data, size_t len);
+	bool WriteAll(const void *data, size_t len);
+	void Run();
+
+	int fd;
+	std::string path;
+	size_t interfaces;
+	std::vector<uint8_t> ring;
+	std::thread writer;
+	std::atomic<bool> stopping;
+	/*head and tail are written by different threads, the padding keeps them on separate cache lines*/
+	std::atomic<uint64_t> head;	//bytes put into the ring, written by the capture thread
+	char headPad[64 - sizeof(std::atomic<uint64_t>)];
+	std::atomic<uint64_t> tail;	//bytes taken out of the ring, written by the writer
+	char tailPad[64 - sizeof(std::atomic<uint64_t>)];
+
+	/*capture thread statistics*/
+	uint64_t packets;
+	uint64_t droppedPackets;
+	uint64_t highWater;	//most bytes waiting in the ring at once
+	/*writer statistics, read after it was joined*/
+	uint64_t writtenBytes;
+	int writeError;	//errno of the first failed write, 0 if none
+
+	PcapngTee(const PcapngTee &);
+	PcapngTee &operator=(const PcapngTee &);
+};
+
+#endif
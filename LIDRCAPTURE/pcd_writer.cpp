@@ -0,0 +1,157 @@
+#include "pcd_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "lzf.h"
+
+/*bytes of one point in the file: x, y, z, intensity, ring, time*/
+#define PCD_POINT_LEN (4 + 4 + 4 + 4 + 2 + 4)
+#define PCD_HEADER_LEN 512
+#define PCD_PATH_LEN 128
+
+PcdWriter::PcdWriter(const char *prefix, PcdFormat format)
+	: prefix(prefix), format(format), files(0), bytes(0)
+{
+}
+
+static bool WriteAll(int fd, const void *data, size_t len)
+{
+	const char *p = (const char *)data;
+
+	while (len > 0)
+	{
+		ssize_t n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+void PcdWriter::PackBinary(const Sweep &sweep)
+{
+	data.resize(sweep.count * PCD_POINT_LEN);
+	uint8_t *p = data.data();
+
+	for (size_t i = 0; i < sweep.count; i++)
+	{
+		float intensity = sweep.reflectivity[i];
+		uint16_t ring = sweep.laser[i];
+		float time = (float)((sweep.timeNs[i] - sweep.info.startNs) * 1e-9);
+
+		memcpy(p, &sweep.x[i], 4);
+		memcpy(p + 4, &sweep.y[i], 4);
+		memcpy(p + 8, &sweep.z[i], 4);
+		memcpy(p + 12, &intensity, 4);
+		memcpy(p + 16, &ring, 2);
+		memcpy(p + 18, &time, 4);
+		p += PCD_POINT_LEN;
+	}
+}
+
+void PcdWriter::PackColumns(const Sweep &sweep)
+{
+	size_t n = sweep.count;
+	data.resize(n * PCD_POINT_LEN);
+	uint8_t *p = data.data();
+
+	/*the coordinates are already stored one array per field*/
+	memcpy(p, sweep.x.data(), n * 4);
+	memcpy(p + n * 4, sweep.y.data(), n * 4);
+	memcpy(p + n * 8, sweep.z.data(), n * 4);
+
+	float *intensity = (float *)(p + n * 12);
+	uint16_t *ring = (uint16_t *)(p + n * 16);
+	uint8_t *time = p + n * 18;
+	for (size_t i = 0; i < n; i++)
+		intensity[i] = sweep.reflectivity[i];
+	for (size_t i = 0; i < n; i++)
+		ring[i] = sweep.laser[i];
+	/*n * 18 is only 2 byte aligned for an odd n, the floats are copied in*/
+	for (size_t i = 0; i < n; i++)
+	{
+		float t = (float)((sweep.timeNs[i] - sweep.info.startNs) * 1e-9);
+		memcpy(time + i * 4, &t, 4);
+	}
+}
+
+bool PcdWriter::WriteSweep(const Sweep &sweep, char *errbuf)
+{
+	char path[PCD_PATH_LEN];
+	char header[PCD_HEADER_LEN];
+	const uint8_t *body;
+	size_t bodyLen;
+	int headerLen;
+
+	snprintf(path, sizeof(path), "%s_%u_%06llu.pcd", prefix.c_str(), sweep.info.sensor,
+		(unsigned long long)sweep.info.sequence);
+	headerLen = snprintf(header, sizeof(header),
+		"# .PCD v0.7 - Point Cloud Data file format\n"
+		"VERSION 0.7\n"
+		"FIELDS x y z intensity ring time\n"
+		"SIZE 4 4 4 4 2 4\n"
+		"TYPE F F F F U F\n"
+		"COUNT 1 1 1 1 1 1\n"
+		"WIDTH %zu\n"
+		"HEIGHT 1\n"
+		"VIEWPOINT 0 0 0 1 0 0 0\n"
+		"POINTS %zu\n"
+		"DATA %s\n", sweep.count, sweep.count, format == PCD_BINARY ? "binary" : "binary_compressed");
+
+	if (format == PCD_BINARY)
+	{
+		PackBinary(sweep);
+		body = data.data();
+		bodyLen = data.size();
+	}
+	else
+	{
+		/*the compressed and the uncompressed size come first*/
+		PackColumns(sweep);
+		compressed.resize(2 * sizeof(uint32_t) + LZF_MAX_COMPRESSED_LEN(data.size()));
+		uint32_t sizes[2];
+		sizes[0] = (uint32_t)LzfCompress(data.data(), data.size(), compressed.data() + sizeof(sizes),
+			compressed.size() - sizeof(sizes));
+		sizes[1] = (uint32_t)data.size();
+		memcpy(compressed.data(), sizes, sizeof(sizes));
+		body = compressed.data();
+		bodyLen = sizeof(sizes) + sizes[0];
+	}
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path, strerror(errno));
+		return false;
+	}
+	bool ok = WriteAll(fd, header, headerLen) && WriteAll(fd, body, bodyLen);
+	if (!ok)
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path, strerror(errno));
+	if (close(fd) < 0 && ok)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path, strerror(errno));
+		ok = false;
+	}
+	if (ok)
+	{
+		files++;
+		bytes += headerLen + bodyLen;
+	}
+	return ok;
+}
+
+uint64_t PcdWriter::Files() const
+{
+	return files;
+}
+
+uint64_t PcdWriter::Bytes() const
+{
+	return bytes;
+}
@@ -0,0 +1,47 @@
+#ifndef PCD_WRITER_H
+#define PCD_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "sweep_assembler.h"
+
+/*how the points of a PCD file are stored*/
+enum PcdFormat
+{
+	PCD_BINARY,	//one record of all fields per point
+	PCD_BINARY_COMPRESSED	//one array per field, LZF compressed
+};
+
+/*Writes every sweep to its own PCD file, <prefix>_<sensor>_<sequence>.pcd.
+the fields are those of the usual velodyne point type: x y z and intensity as floats, ring as a 16 bit laser id and
+time as float seconds since the start of the sweep. binary_compressed stores the fields one after the other, the
+same layout the sweep keeps them in, so most of the file is copied straight out of the sweep arrays. the staging
+buffers grow to the largest sweep and are reused, meant to be called from the sweep consumer thread so the capture
+never waits for the disk.*/
+class PcdWriter
+{
+public:
+	PcdWriter(const char *prefix, PcdFormat format);
+
+	/*writes one sweep. returns false and fills errbuf (CAPTURE_ERRBUF_SIZE bytes) if the file cannot be written.*/
+	bool WriteSweep(const Sweep &sweep, char *errbuf);
+
+	uint64_t Files() const;
+	uint64_t Bytes() const;
+
+private:
+	/*fills data with the fields of the sweep in the layout of the format*/
+	void PackBinary(const Sweep &sweep);
+	void PackColumns(const Sweep &sweep);
+
+	std::string prefix;
+	PcdFormat format;
+	std::vector<uint8_t> data;	//point data as stored, before compression
+	std::vector<uint8_t> compressed;
+	uint64_t files;
+	uint64_t bytes;
+};
+
+#endif
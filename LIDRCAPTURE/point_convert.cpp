@@ -0,0 +1,227 @@
+#include "point_convert.h"
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#define DEGREES_TO_RADIANS (M_PI / 180.0)
+
+/*sin and cos of every azimuth the sensor can report*/
+struct AzimuthTable
+{
+	float sinAz[AZIMUTH_STEPS];
+	float cosAz[AZIMUTH_STEPS];
+
+	AzimuthTable()
+	{
+		for (int a = 0; a < AZIMUTH_STEPS; a++)
+		{
+			sinAz[a] = (float)sin(a * 0.01 * DEGREES_TO_RADIANS);
+			cosAz[a] = (float)cos(a * 0.01 * DEGREES_TO_RADIANS);
+		}
+	}
+};
+
+/*the tables are function statics so they are built once, on first use, from whichever thread gets there first*/
+static const AzimuthTable &Azimuths()
+{
+	static const AzimuthTable table;
+	return table;
+}
+
+/*corrections of an uncalibrated sensor: the nominal vertical angles of the model and nothing else*/
+template <class Model>
+static CalibrationTable BuildNominalTable()
+{
+	LaserCorrection corrections[Model::channels];
+	CalibrationTable table;
+
+	memset(corrections, 0, sizeof(corrections));
+	for (int l = 0; l < Model::channels; l++)
+		corrections[l].vertCorrection = Model::verticalAngle[l] * DEGREES_TO_RADIANS;
+	BuildCalibrationTable(corrections, Model::channels, table);
+	return table;
+}
+
+template <class Model>
+static const CalibrationTable &NominalTable()
+{
+	static const CalibrationTable table = BuildNominalTable<Model>();
+	return table;
+}
+
+PointFilter::PointFilter()
+	: minRange(0), maxRange(FLT_MAX), minReflectivity(0)
+{
+	memset(sectors, 1, sizeof(sectors));
+	for (int i = 0; i < 3; i++)
+	{
+		boxMin[i] = -FLT_MAX;
+		boxMax[i] = FLT_MAX;
+	}
+}
+
+void PointFilter::SetSector(double from, double to)
+{
+	int first = ((int)floor(from) % FILTER_SECTORS + FILTER_SECTORS) % FILTER_SECTORS;
+	int last = ((int)ceil(to) % FILTER_SECTORS + FILTER_SECTORS) % FILTER_SECTORS;
+
+	memset(sectors, 0, sizeof(sectors));
+	for (int s = first; s != last; s = (s + 1) % FILTER_SECTORS)
+		sectors[s] = 1;
+	if (first == last)
+		memset(sectors, 1, sizeof(sectors));
+}
+
+void InitConvertTables()
+{
+	Azimuths();
+	NominalTable<Vlp16>();
+	NominalTable<Vlp32c>();
+	NominalTable<Hdl32e>();
+}
+
+/*output conversions from meters, as they are and to millimeters rounded to the nearest integer*/
+static inline void Store(float v, float &out)
+{
+	out = v;
+}
+
+static inline void Store(float v, int32_t &out)
+{
+	v *= 1000.0f;
+	out = (int32_t)(v < 0 ? v - 0.5f : v + 0.5f);
+}
+
+/*the conversion of the ROS velodyne driver with the corrections of table. the table lookups are gathers and are done
+first, the arithmetic after them is straight line code over the 32 returns the compiler vectorizes.*/
+template <class Block>
+static void ConvertBlockTable(const DataBlock &block, const uint16_t *azimuth, const CalibrationTable &t,
+	const PointFilter &filter, Block &out)
+{
+	const AzimuthTable &az = Azimuths();
+	alignas(16) float sinAz[CHANNELS_PER_BLOCK];
+	alignas(16) float cosAz[CHANNELS_PER_BLOCK];
+	alignas(16) uint8_t sector[CHANNELS_PER_BLOCK];
+
+	for (int c = 0; c < CHANNELS_PER_BLOCK; c++)
+	{
+		sinAz[c] = az.sinAz[azimuth[c]];
+		cosAz[c] = az.cosAz[azimuth[c]];
+		sector[c] = filter.sectors[azimuth[c] / 100];
+	}
+
+	for (int c = 0; c < CHANNELS_PER_BLOCK; c++)
+	{
+		/*a return without an echo still goes through the arithmetic, is zeroed at the end and never kept*/
+		float valid = (block.distance[c] != 0) ? 1.0f : 0.0f;
+		float d = block.distance[c] * 0.001f + t.distCorrection[c];
+		float sinRot = sinAz[c] * t.cosRot[c] - cosAz[c] * t.sinRot[c];	//sin and cos of azimuth - rotCorrection
+		float cosRot = cosAz[c] * t.cosRot[c] + sinAz[c] * t.sinRot[c];
+
+		float horizontal = d * t.cosVert[c] - t.vertOffset[c] * t.sinVert[c];
+		float xx = fabsf(horizontal * sinRot - t.horizOffset[c] * cosRot);
+		float yy = fabsf(horizontal * cosRot + t.horizOffset[c] * sinRot);
+		float dx = d + t.slopeX[c] * xx + t.offsetX[c];
+		float dy = d + t.slopeY[c] * yy + t.offsetY[c];
+		float horizontalX = dx * t.cosVert[c] - t.vertOffset[c] * t.sinVert[c];
+		float horizontalY = dy * t.cosVert[c] - t.vertOffset[c] * t.sinVert[c];
+
+		float x = valid * (horizontalX * sinRot - t.horizOffset[c] * cosRot);
+		float y = valid * (horizontalY * cosRot + t.horizOffset[c] * sinRot);
+		float z = valid * (dy * t.sinVert[c] + t.vertOffset[c] * t.cosVert[c]);
+
+		/*bitwise and on purpose, every test is evaluated*/
+		int keep = (block.distance[c] != 0) & (d >= filter.minRange) & (d <= filter.maxRange)
+			& (block.reflectivity[c] >= filter.minReflectivity) & sector[c]
+			& (x >= filter.boxMin[0]) & (x <= filter.boxMax[0]) & (y >= filter.boxMin[1]) & (y <= filter.boxMax[1])
+			& (z >= filter.boxMin[2]) & (z <= filter.boxMax[2]);
+
+		Store(x, out.x[c]);
+		Store(y, out.y[c]);
+		Store(z, out.z[c]);
+		out.keep[c] = (uint8_t)keep;
+	}
+}
+
+/*the calibration of the sensor if it was loaded for this model, the nominal angles otherwise*/
+template <class Model>
+static inline const CalibrationTable &TableFor(const CalibrationTable *calibration)
+{
+	return (calibration != NULL && calibration->lasers == Model::channels) ? *calibration : NominalTable<Model>();
+}
+
+template <class Block>
+static void ConvertBlockAny(SensorModelId model, const DataBlock &block, const uint16_t *azimuth,
+	const CalibrationTable *calibration, const PointFilter &filter, Block &out)
+{
+	switch (model)
+	{
+	case SENSOR_VLP16:
+		ConvertBlockTable(block, azimuth, TableFor<Vlp16>(calibration), filter, out);
+		break;
+	case SENSOR_VLP32C:
+		ConvertBlockTable(block, azimuth, TableFor<Vlp32c>(calibration), filter, out);
+		break;
+	case SENSOR_HDL32E:
+		ConvertBlockTable(block, azimuth, TableFor<Hdl32e>(calibration), filter, out);
+		break;
+	default:
+		break;
+	}
+}
+
+void ConvertBlock(SensorModelId model, const DataBlock &block, const uint16_t *azimuth,
+	const CalibrationTable *calibration, const PointFilter &filter, PointBlock &out)
+{
+	ConvertBlockAny(model, block, azimuth, calibration, filter, out);
+}
+
+void ConvertBlock(SensorModelId model, const DataBlock &block, const uint16_t *azimuth,
+	const CalibrationTable *calibration, const PointFilter &filter, PointBlockFixed &out)
+{
+	ConvertBlockAny(model, block, azimuth, calibration, filter, out);
+}
+
+template <class Model, class Points>
+static void ConvertPacketModel(const DataPacket &packet, const PointTiming &timing, const CalibrationTable *calibration,
+	const PointFilter &filter, Points &points)
+{
+	const CalibrationTable &table = TableFor<Model>(calibration);
+
+	for (int b = 0; b < BLOCKS_PER_PACKET; b++)
+		ConvertBlockTable(packet.blocks[b], timing.azimuth[b], table, filter, points.blocks[b]);
+}
+
+/*the model and the table are picked once per packet, every block of it goes through the same instantiation*/
+template <class Points>
+static void ConvertPacketAny(const DataPacket &packet, const PointTiming &timing, const CalibrationTable *calibration,
+	const PointFilter &filter, Points &points)
+{
+	switch (packet.model)
+	{
+	case SENSOR_VLP16:
+		ConvertPacketModel<Vlp16>(packet, timing, calibration, filter, points);
+		break;
+	case SENSOR_VLP32C:
+		ConvertPacketModel<Vlp32c>(packet, timing, calibration, filter, points);
+		break;
+	case SENSOR_HDL32E:
+		ConvertPacketModel<Hdl32e>(packet, timing, calibration, filter, points);
+		break;
+	default:
+		break;
+	}
+}
+
+void ConvertPacket(const DataPacket &packet, const PointTiming &timing, const CalibrationTable *calibration,
+	const PointFilter &filter, PointPacket &points)
+{
+	ConvertPacketAny(packet, timing, calibration, filter, points);
+}
+
+void ConvertPacket(const DataPacket &packet, const PointTiming &timing, const CalibrationTable *calibration,
+	const PointFilter &filter, PointPacketFixed &points)
+{
+	ConvertPacketAny(packet, timing, calibration, filter, points);
+}
@@ -0,0 +1,82 @@
+#ifndef POINT_CONVERT_H
+#define POINT_CONVERT_H
+
+#include <stdint.h>
+#include "packet_decoder.h"
+#include "point_timing.h"
+#include "calibration.h"
+
+/*sensor frame: x to the right, y forward (azimuth 0), z up, all relative to the optical center*/
+
+/*the XYZ coordinates of the 32 returns of one block, in meters. a return without an echo converts to the origin.
+keep is 1 for the returns that had an echo and passed the PointFilter, only those should be passed on.*/
+struct PointBlock
+{
+	alignas(16) float x[CHANNELS_PER_BLOCK];
+	alignas(16) float y[CHANNELS_PER_BLOCK];
+	alignas(16) float z[CHANNELS_PER_BLOCK];
+	alignas(16) uint8_t keep[CHANNELS_PER_BLOCK];
+};
+
+/*the same in whole millimeters, for consumers that want integers*/
+struct PointBlockFixed
+{
+	alignas(16) int32_t x[CHANNELS_PER_BLOCK];
+	alignas(16) int32_t y[CHANNELS_PER_BLOCK];
+	alignas(16) int32_t z[CHANNELS_PER_BLOCK];
+	alignas(16) uint8_t keep[CHANNELS_PER_BLOCK];
+};
+
+/*a converted data packet, block for block (and so return for return in dual return mode) like DataPacket*/
+struct PointPacket
+{
+	PointBlock blocks[BLOCKS_PER_PACKET];
+};
+
+struct PointPacketFixed
+{
+	PointBlockFixed blocks[BLOCKS_PER_PACKET];
+};
+
+/*number of entries of the azimuth sin/cos table, one per hundredth of a degree*/
+#define AZIMUTH_STEPS 36000
+/*the sector mask of the filter has one entry per degree*/
+#define FILTER_SECTORS 360
+
+/*which returns the conversion keeps. every test is evaluated for every return without branches and the results are
+and'ed into PointBlock::keep, so a filter costs the same whatever it lets through. returns without an echo are never
+kept.*/
+struct PointFilter
+{
+	float minRange;	//meters, after calibration
+	float maxRange;
+	uint8_t minReflectivity;
+	uint8_t sectors[FILTER_SECTORS];	//1 for the degrees of azimuth to keep
+	float boxMin[3];	//x, y, z in meters, points outside the box are dropped
+	float boxMax[3];
+
+	/*a filter that keeps every return with an echo*/
+	PointFilter();
+	/*keeps only azimuths from one angle to the other in degrees, clockwise and across 0 if needed*/
+	void SetSector(double from, double to);
+};
+
+/*builds the trig table and the nominal correction tables of the models. they are built on first use anyway, calling
+this at startup keeps that out of the capture loop.*/
+void InitConvertTables();
+
+/*converts the returns of one block fired by a sensor of the given model. azimuth holds the azimuth of each of the
+32 returns in hundredths of a degree, 0-35999. calibration is the sensor's loaded calibration, when it is NULL or
+for a different number of lasers the model's nominal vertical angles are used.*/
+void ConvertBlock(SensorModelId model, const DataBlock &block, const uint16_t *azimuth,
+	const CalibrationTable *calibration, const PointFilter &filter, PointBlock &out);
+void ConvertBlock(SensorModelId model, const DataBlock &block, const uint16_t *azimuth,
+	const CalibrationTable *calibration, const PointFilter &filter, PointBlockFixed &out);
+
+/*converts a whole decoded packet, every return at its own azimuth from ComputePointTiming*/
+void ConvertPacket(const DataPacket &packet, const PointTiming &timing, const CalibrationTable *calibration,
+	const PointFilter &filter, PointPacket &points);
+void ConvertPacket(const DataPacket &packet, const PointTiming &timing, const CalibrationTable *calibration,
+	const PointFilter &filter, PointPacketFixed &points);
+
+#endif
@@ -0,0 +1,128 @@
+#include "point_timing.h"
+#include "point_convert.h"
+
+#define HOUR_NS 3600000000000ULL
+#define HALF_HOUR_US 1800000000ULL
+/*the interpolation fractions are 16 bit fixed point*/
+#define FRACTION_BITS 16
+
+/*offsets of every return from the packet timestamp, for single and dual return packets, and how far through its
+firing's azimuth step each return of a block was fired*/
+struct FiringTable
+{
+	alignas(16) uint32_t offsetNs[2][BLOCKS_PER_PACKET][CHANNELS_PER_BLOCK];
+	alignas(16) uint32_t fraction[CHANNELS_PER_BLOCK];
+};
+
+template <class Model>
+static FiringTable BuildFiringTable()
+{
+	FiringTable table;
+
+	for (int returns = 1; returns <= 2; returns++)
+	{
+		for (int b = 0; b < BLOCKS_PER_PACKET; b++)
+		{
+			int firing = b / returns;	//both blocks of a dual return pair come from the same firing
+			for (int c = 0; c < CHANNELS_PER_BLOCK; c++)
+			{
+				double offsetUs = firing * BlockDurationUs<Model>() + ReturnOffsetUs<Model>(c);
+				table.offsetNs[returns - 1][b][c] = (uint32_t)(offsetUs * 1000 + 0.5);
+			}
+		}
+	}
+	for (int c = 0; c < CHANNELS_PER_BLOCK; c++)
+		table.fraction[c] = (uint32_t)(ReturnOffsetUs<Model>(c) / BlockDurationUs<Model>() * (1 << FRACTION_BITS) + 0.5);
+	return table;
+}
+
+template <class Model>
+static const FiringTable &Firings()
+{
+	static const FiringTable table = BuildFiringTable<Model>();
+	return table;
+}
+
+void InitTimingTables()
+{
+	Firings<Vlp16>();
+	Firings<Vlp32c>();
+	Firings<Hdl32e>();
+}
+
+uint64_t PacketTimeNs(uint32_t pastHourUs, uint64_t captureNs)
+{
+	uint64_t hourBase = captureNs - captureNs % HOUR_NS;
+	uint64_t captureUs = (captureNs % HOUR_NS) / 1000;
+
+	/*the host clock and the sensor clock are close but not the same. a sensor time far ahead of the host's is still
+	in the previous hour, one far behind is already in the next.*/
+	if (pastHourUs > captureUs + HALF_HOUR_US && hourBase >= HOUR_NS)
+		hourBase -= HOUR_NS;
+	else if (pastHourUs + HALF_HOUR_US < captureUs)
+		hourBase += HOUR_NS;
+	return hourBase + (uint64_t)pastHourUs * 1000;
+}
+
+/*an azimuth as read from the packet, brought into 0-35999. the sensor only sends 0-35999, this keeps a corrupt
+packet from indexing past the end of the trig table.*/
+static inline uint32_t WrapAzimuth(uint32_t azimuth)
+{
+	return (azimuth < AZIMUTH_STEPS) ? azimuth : azimuth - AZIMUTH_STEPS;
+}
+
+template <class Model>
+static void ComputePointTimingModel(const DataPacket &packet, uint64_t captureNs, PointTiming &timing)
+{
+	const FiringTable &table = Firings<Model>();
+	const int returns = packet.returnsPerFiring;
+	const int firings = packet.firings;
+	const uint64_t base = PacketTimeNs(packet.timestamp, captureNs);
+	uint32_t azimuth[BLOCKS_PER_PACKET];
+	uint32_t step[BLOCKS_PER_PACKET];
+
+	for (int b = 0; b < BLOCKS_PER_PACKET; b++)
+	{
+		const uint32_t *offset = table.offsetNs[returns - 1][b];
+		for (int c = 0; c < CHANNELS_PER_BLOCK; c++)
+			timing.timeNs[b][c] = base + offset[c];
+	}
+
+	/*how far the head turned between each firing and the next*/
+	for (int f = 0; f < firings; f++)
+		azimuth[f] = WrapAzimuth(packet.blocks[f * returns].azimuth);
+	for (int f = 0; f + 1 < firings; f++)
+		step[f] = (azimuth[f + 1] + AZIMUTH_STEPS - azimuth[f]) % AZIMUTH_STEPS;
+	step[firings - 1] = step[firings - 2];
+
+	for (int f = 0; f < firings; f++)
+	{
+		for (int r = 0; r < returns; r++)
+		{
+			uint16_t *out = timing.azimuth[f * returns + r];
+			for (int c = 0; c < CHANNELS_PER_BLOCK; c++)
+			{
+				uint32_t a = azimuth[f] + ((step[f] * table.fraction[c]) >> FRACTION_BITS);
+				out[c] = (uint16_t)(a >= AZIMUTH_STEPS ? a - AZIMUTH_STEPS : a);
+			}
+		}
+	}
+}
+
+void ComputePointTiming(const DataPacket &packet, uint64_t captureNs, PointTiming &timing)
+{
+	switch (packet.model)
+	{
+	case SENSOR_VLP16:
+		ComputePointTimingModel<Vlp16>(packet, captureNs, timing);
+		break;
+	case SENSOR_VLP32C:
+		ComputePointTimingModel<Vlp32c>(packet, captureNs, timing);
+		break;
+	case SENSOR_HDL32E:
+		ComputePointTimingModel<Hdl32e>(packet, captureNs, timing);
+		break;
+	default:
+		break;
+	}
+}
@@ -0,0 +1,28 @@
+#ifndef POINT_TIMING_H
+#define POINT_TIMING_H
+
+#include <stdint.h>
+#include "packet_decoder.h"
+
+/*when and where each return of a data packet was fired. the sensor only sends one azimuth per block and one time per
+packet, the rest follows from the model's firing sequence: returns later in a block were fired later, and the head
+has turned a little further by then.*/
+struct PointTiming
+{
+	alignas(16) uint16_t azimuth[BLOCKS_PER_PACKET][CHANNELS_PER_BLOCK];	//hundredths of a degree, 0-35999
+	alignas(16) uint64_t timeNs[BLOCKS_PER_PACKET][CHANNELS_PER_BLOCK];	//nanoseconds since the epoch
+};
+
+/*turns a microseconds past the hour timestamp into nanoseconds since the epoch. the hour is taken from captureNs,
+the host's time of capture, and moved by one when the two are on different sides of a full hour.*/
+uint64_t PacketTimeNs(uint32_t pastHourUs, uint64_t captureNs);
+
+/*builds the firing tables of all models. they are built on first use anyway, calling this at startup keeps that
+out of the capture loop.*/
+void InitTimingTables();
+
+/*fills in the azimuth and time of every return of a decoded packet. azimuths are interpolated between the azimuths
+of consecutive firings (the last firing uses the step before it), with wrap-around at 36000.*/
+void ComputePointTiming(const DataPacket &packet, uint64_t captureNs, PointTiming &timing);
+
+#endif
@@ -0,0 +1,573 @@
+#include "recording.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define RECORDING_ALIGN 16
+#define RETURNS_PER_PACKET (BLOCKS_PER_PACKET * CHANNELS_PER_BLOCK)
+
+static_assert(sizeof(RecordingFileHeader) == 32, "file header layout");
+static_assert(sizeof(RecordingChunkHeader) == 48, "chunk header layout");
+static_assert(sizeof(RecordingIndexEntry) == 32, "index entry layout");
+static_assert(sizeof(RecordingTrailer) == 24, "trailer layout");
+
+/*the columns of a chunk in the order they are stored*/
+enum RecordingColumn
+{
+	COLUMN_KIND,
+	COLUMN_CAPTURE_NS,
+	COLUMN_TIMESTAMP,
+	COLUMN_SENSOR,
+	COLUMN_RETURN_MODE,
+	COLUMN_PRODUCT_ID,
+	COLUMN_AZIMUTH,
+	COLUMN_DISTANCE,
+	COLUMN_REFLECTIVITY,
+	COLUMN_POSITION_CAPTURE_NS,
+	COLUMN_POSITION_TIMESTAMP,
+	COLUMN_POSITION_SENSOR,
+	COLUMN_NMEA_LEN,
+	COLUMN_NMEA,
+	RECORDING_COLUMNS
+};
+
+static uint64_t Align(uint64_t n)
+{
+	return (n + RECORDING_ALIGN - 1) & ~(uint64_t)(RECORDING_ALIGN - 1);
+}
+
+/*sizes and offsets from the chunk header of the columns of a chunk, shared by the writer and the reader so they
+cannot disagree. returns the length of the whole chunk.*/
+static uint64_t ChunkLayout(uint32_t records, uint32_t dataPackets, uint32_t positionPackets,
+	uint64_t sizes[RECORDING_COLUMNS], uint64_t offsets[RECORDING_COLUMNS])
+{
+	uint64_t data = dataPackets;
+	uint64_t positions = positionPackets;
+
+	sizes[COLUMN_KIND] = records;
+	sizes[COLUMN_CAPTURE_NS] = data * sizeof(uint64_t);
+	sizes[COLUMN_TIMESTAMP] = data * sizeof(uint32_t);
+	sizes[COLUMN_SENSOR] = data;
+	sizes[COLUMN_RETURN_MODE] = data;
+	sizes[COLUMN_PRODUCT_ID] = data;
+	sizes[COLUMN_AZIMUTH] = data * BLOCKS_PER_PACKET * sizeof(uint16_t);
+	sizes[COLUMN_DISTANCE] = data * RETURNS_PER_PACKET * sizeof(uint16_t);
+	sizes[COLUMN_REFLECTIVITY] = data * RETURNS_PER_PACKET;
+	sizes[COLUMN_POSITION_CAPTURE_NS] = positions * sizeof(uint64_t);
+	sizes[COLUMN_POSITION_TIMESTAMP] = positions * sizeof(uint32_t);
+	sizes[COLUMN_POSITION_SENSOR] = positions;
+	sizes[COLUMN_NMEA_LEN] = positions * sizeof(uint16_t);
+	sizes[COLUMN_NMEA] = positions * RECORDING_NMEA_LEN;
+
+	uint64_t offset = Align(sizeof(RecordingChunkHeader));
+	for (int c = 0; c < RECORDING_COLUMNS; c++)
+	{
+		offsets[c] = offset;
+		offset = Align(offset + sizes[c]);
+	}
+	return offset;
+}
+
+RecordingWriter::Chunk::Chunk()
+	: kind(RECORDING_CHUNK_PACKETS + RECORDING_CHUNK_POSITIONS), captureNs(RECORDING_CHUNK_PACKETS),
+	timestamp(RECORDING_CHUNK_PACKETS), sensor(RECORDING_CHUNK_PACKETS), returnMode(RECORDING_CHUNK_PACKETS),
+	productId(RECORDING_CHUNK_PACKETS), azimuth(RECORDING_CHUNK_PACKETS * BLOCKS_PER_PACKET),
+	distance(RECORDING_CHUNK_PACKETS * RETURNS_PER_PACKET), reflectivity(RECORDING_CHUNK_PACKETS * RETURNS_PER_PACKET),
+	positionCaptureNs(RECORDING_CHUNK_POSITIONS), positionTimestamp(RECORDING_CHUNK_POSITIONS),
+	positionSensor(RECORDING_CHUNK_POSITIONS), nmeaLen(RECORDING_CHUNK_POSITIONS),
+	nmea(RECORDING_CHUNK_POSITIONS * RECORDING_NMEA_LEN)
+{
+	memset(&header, 0, sizeof(header));
+}
+
+RecordingWriter::RecordingWriter()
+	: fd(-1), packets(0), droppedChunks(0), droppedPackets(0), offset(0), writeError(0)
+{
+}
+
+RecordingWriter::~RecordingWriter()
+{
+	char errbuf[CAPTURE_ERRBUF_SIZE];
+
+	if (fd >= 0)
+		Close(errbuf);
+	for (size_t c = 0; c < chunks.size(); c++)
+		delete chunks[c];
+}
+
+bool RecordingWriter::WriteAll(const void *data, size_t len)
+{
+	const char *p = (const char *)data;
+
+	while (len > 0)
+	{
+		ssize_t n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+		{
+			if (writeError == 0)
+				writeError = errno;
+			return false;
+		}
+		p += n;
+		len -= n;
+		offset += n;
+	}
+	return true;
+}
+
+bool RecordingWriter::Open(const char *path, char *errbuf)
+{
+	RecordingFileHeader header;
+	struct timespec now;
+
+	this->path = path;
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path, strerror(errno));
+		return false;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+	header.version = RECORDING_VERSION;
+	header.chunkPackets = RECORDING_CHUNK_PACKETS;
+	header.createdNs = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+	offset = 0;
+	packets = 0;
+	writeError = 0;
+	index.clear();
+	if (!WriteAll(&header, sizeof(header)))
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path, strerror(writeError));
+		close(fd);
+		fd = -1;
+		return false;
+	}
+
+	for (int c = 0; c < RECORDING_CHUNKS; c++)
+		chunks.push_back(new Chunk());
+	/*after a failed write the chunks are still taken back so the capture keeps going*/
+	pool.Start(chunks, [this](Chunk &chunk)
+	{
+		if (writeError == 0)
+			WriteChunk(chunk);
+	});
+	return true;
+}
+
+void RecordingWriter::AddDataPacket(const DataPacket &packet, uint64_t captureNs, unsigned int sensor)
+{
+	if (pool.Current() == NULL)
+		return;
+
+	Chunk &chunk = *pool.Current();
+	uint32_t p = chunk.header.dataPackets++;
+	uint32_t resolution = SensorModelDistanceResolution(packet.model);
+
+	if (chunk.header.records == 0)
+		chunk.header.startNs = captureNs;
+	chunk.header.endNs = captureNs;
+	chunk.kind[chunk.header.records++] = RECORD_DATA;
+	chunk.captureNs[p] = captureNs;
+	chunk.timestamp[p] = packet.timestamp;
+	chunk.sensor[p] = (uint8_t)sensor;
+	chunk.returnMode[p] = packet.returnMode;
+	chunk.productId[p] = packet.productId;
+
+	for (int b = 0; b < BLOCKS_PER_PACKET; b++)
+	{
+		const DataBlock &block = packet.blocks[b];
+		uint16_t *d = &chunk.distance[(size_t)p * RETURNS_PER_PACKET + b * CHANNELS_PER_BLOCK];
+
+		chunk.azimuth[(size_t)p * BLOCKS_PER_PACKET + b] = block.azimuth;
+		for (int c = 0; c < CHANNELS_PER_BLOCK; c++)
+			d[c] = (uint16_t)(block.distance[c] / resolution);
+		memcpy(&chunk.reflectivity[(size_t)p * RETURNS_PER_PACKET + b * CHANNELS_PER_BLOCK], block.reflectivity,
+			CHANNELS_PER_BLOCK);
+	}
+	packets++;
+
+	if (chunk.header.dataPackets == RECORDING_CHUNK_PACKETS)
+		Submit();
+}
+
+void RecordingWriter::AddPositionPacket(const PositionPacket &packet, uint64_t captureNs, unsigned int sensor)
+{
+	if (pool.Current() == NULL)
+		return;
+
+	Chunk &chunk = *pool.Current();
+	uint32_t p = chunk.header.positionPackets++;
+
+	if (chunk.header.records == 0)
+		chunk.header.startNs = captureNs;
+	chunk.header.endNs = captureNs;
+	chunk.kind[chunk.header.records++] = RECORD_POSITION;
+	chunk.positionCaptureNs[p] = captureNs;
+	chunk.positionTimestamp[p] = packet.timestamp;
+	chunk.positionSensor[p] = (uint8_t)sensor;
+	chunk.nmeaLen[p] = (uint16_t)packet.nmeaLen;
+	/*the sentence is followed by the rest of the packet, RECORDING_NMEA_LEN bytes are always there*/
+	memcpy(&chunk.nmea[(size_t)p * RECORDING_NMEA_LEN], packet.nmea, RECORDING_NMEA_LEN);
+	packets++;
+
+	if (chunk.header.positionPackets == RECORDING_CHUNK_POSITIONS)
+		Submit();
+}
+
+void RecordingWriter::Submit(bool last)
+{
+	uint32_t records = pool.Current()->header.records;
+
+	if (!pool.Submit(last))
+	{
+		/*the writer is behind: drop this chunk rather than hold up the capture*/
+		droppedChunks++;
+		droppedPackets += records;
+		packets -= records;
+	}
+	memset(&pool.Current()->header, 0, sizeof(RecordingChunkHeader));
+}
+
+bool RecordingWriter::WriteChunk(Chunk &chunk)
+{
+	static const char padding[RECORDING_ALIGN] = { 0 };
+	RecordingChunkHeader &header = chunk.header;
+	uint64_t sizes[RECORDING_COLUMNS];
+	uint64_t offsets[RECORDING_COLUMNS];
+	const void *columns[RECORDING_COLUMNS] =
+	{
+		chunk.kind.data(), chunk.captureNs.data(), chunk.timestamp.data(), chunk.sensor.data(),
+		chunk.returnMode.data(), chunk.productId.data(), chunk.azimuth.data(), chunk.distance.data(),
+		chunk.reflectivity.data(), chunk.positionCaptureNs.data(), chunk.positionTimestamp.data(),
+		chunk.positionSensor.data(), chunk.nmeaLen.data(), chunk.nmea.data()
+	};
+	struct iovec iov[2 * RECORDING_COLUMNS + 2];
+	int iovcnt = 0;
+
+	memcpy(header.magic, RECORDING_CHUNK_MAGIC, sizeof(header.magic));
+	header.length = ChunkLayout(header.records, header.dataPackets, header.positionPackets, sizes, offsets);
+
+	RecordingIndexEntry entry;
+	entry.offset = offset;
+	entry.startNs = header.startNs;
+	entry.endNs = header.endNs;
+	entry.dataPackets = header.dataPackets;
+	entry.positionPackets = header.positionPackets;
+
+	/*header and columns with their padding in one call*/
+	uint64_t end = sizeof(header);
+	iov[iovcnt].iov_base = &header;
+	iov[iovcnt++].iov_len = sizeof(header);
+	for (int c = 0; c < RECORDING_COLUMNS; c++)
+	{
+		if (offsets[c] > end)
+		{
+			iov[iovcnt].iov_base = (void *)padding;
+			iov[iovcnt++].iov_len = offsets[c] - end;
+		}
+		if (sizes[c] > 0)
+		{
+			iov[iovcnt].iov_base = (void *)columns[c];
+			iov[iovcnt++].iov_len = sizes[c];
+		}
+		end = offsets[c] + sizes[c];
+	}
+	if (header.length > end)
+	{
+		iov[iovcnt].iov_base = (void *)padding;
+		iov[iovcnt++].iov_len = header.length - end;
+	}
+
+	/*a short write continues where it stopped*/
+	struct iovec *next = iov;
+	while (iovcnt > 0)
+	{
+		ssize_t n = writev(fd, next, iovcnt);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+		{
+			/*the chunk is lost and nothing more is written, the reader stops at the broken chunk*/
+			writeError = errno;
+			return false;
+		}
+		offset += n;
+		while (iovcnt > 0 && (size_t)n >= next->iov_len)
+		{
+			n -= next->iov_len;
+			next++;
+			iovcnt--;
+		}
+		if (iovcnt > 0)
+		{
+			next->iov_base = (char *)next->iov_base + n;
+			next->iov_len -= n;
+		}
+	}
+
+	index.push_back(entry);
+	return true;
+}
+
+bool RecordingWriter::Close(char *errbuf)
+{
+	RecordingTrailer trailer;
+	bool ok = true;
+
+	if (fd < 0)
+		return true;
+
+	/*the end of the recording is not dropped*/
+	if (pool.Current()->header.records > 0)
+		Submit(true);
+	pool.Stop();
+
+	memset(&trailer, 0, sizeof(trailer));
+	trailer.indexOffset = offset;
+	trailer.chunks = (uint32_t)index.size();
+	memcpy(trailer.magic, RECORDING_TRAILER_MAGIC, sizeof(trailer.magic));
+	if (writeError == 0)
+	{
+		WriteAll(index.data(), index.size() * sizeof(RecordingIndexEntry));
+		if (writeError == 0)
+			WriteAll(&trailer, sizeof(trailer));
+	}
+	if (writeError != 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path.c_str(), strerror(writeError));
+		ok = false;
+	}
+	if (close(fd) < 0 && ok)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path.c_str(), strerror(errno));
+		ok = false;
+	}
+	fd = -1;
+	return ok;
+}
+
+void RecordingWriter::PrintStats(FILE *out) const
+{
+	fprintf(out, "%s: %llu packets in %zu chunks, %llu bytes, %llu chunks (%llu packets) dropped waiting for the disk\n",
+		path.c_str(), (unsigned long long)packets, index.size(), (unsigned long long)offset,
+		(unsigned long long)droppedChunks, (unsigned long long)droppedPackets);
+}
+
+RecordingReader::RecordingReader()
+	: fd(-1), map(NULL), mapSize(0)
+{
+}
+
+RecordingReader::~RecordingReader()
+{
+	Close();
+}
+
+bool RecordingReader::Open(const char *path, char *errbuf)
+{
+	struct stat st;
+
+	Close();
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", path, strerror(errno));
+		Close();
+		return false;
+	}
+	if ((size_t)st.st_size < sizeof(RecordingFileHeader))
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: too short for a recording", path);
+		Close();
+		return false;
+	}
+
+	mapSize = (size_t)st.st_size;
+	void *m = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (m == MAP_FAILED)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: mmap: %s", path, strerror(errno));
+		map = NULL;
+		Close();
+		return false;
+	}
+	map = (const unsigned char *)m;
+	madvise(m, mapSize, MADV_SEQUENTIAL);
+
+	const RecordingFileHeader *header = (const RecordingFileHeader *)map;
+	if (memcmp(header->magic, RECORDING_MAGIC, sizeof(header->magic)) != 0 || header->version != RECORDING_VERSION)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: not a version %d recording", path, RECORDING_VERSION);
+		Close();
+		return false;
+	}
+
+	if (!LoadIndex())
+		ScanChunks();
+	return true;
+}
+
+void RecordingReader::Close()
+{
+	if (map != NULL)
+		munmap((void *)map, mapSize);
+	if (fd >= 0)
+		close(fd);
+	map = NULL;
+	mapSize = 0;
+	fd = -1;
+	index.clear();
+}
+
+bool RecordingReader::ValidChunk(uint64_t offset, uint64_t limit) const
+{
+	uint64_t sizes[RECORDING_COLUMNS];
+	uint64_t offsets[RECORDING_COLUMNS];
+
+	if (offset % RECORDING_ALIGN != 0 || offset + sizeof(RecordingChunkHeader) > limit)
+		return false;
+	const RecordingChunkHeader *header = (const RecordingChunkHeader *)(map + offset);
+	if (memcmp(header->magic, RECORDING_CHUNK_MAGIC, sizeof(header->magic)) != 0
+		|| header->records != header->dataPackets + header->positionPackets
+		|| header->dataPackets > RECORDING_CHUNK_PACKETS || header->positionPackets > RECORDING_CHUNK_POSITIONS)
+		return false;
+	return header->length == ChunkLayout(header->records, header->dataPackets, header->positionPackets, sizes, offsets)
+		&& header->length <= limit - offset;
+}
+
+bool RecordingReader::LoadIndex()
+{
+	if (mapSize < sizeof(RecordingFileHeader) + sizeof(RecordingTrailer))
+		return false;
+
+	const RecordingTrailer *trailer = (const RecordingTrailer *)(map + mapSize - sizeof(RecordingTrailer));
+	if (memcmp(trailer->magic, RECORDING_TRAILER_MAGIC, sizeof(trailer->magic)) != 0
+		|| trailer->indexOffset < sizeof(RecordingFileHeader)
+		|| trailer->indexOffset + (uint64_t)trailer->chunks * sizeof(RecordingIndexEntry) + sizeof(RecordingTrailer)
+			!= mapSize)
+		return false;
+
+	const RecordingIndexEntry *entries = (const RecordingIndexEntry *)(map + trailer->indexOffset);
+	for (uint32_t c = 0; c < trailer->chunks; c++)
+	{
+		if (!ValidChunk(entries[c].offset, trailer->indexOffset))
+		{
+			index.clear();
+			return false;
+		}
+		index.push_back(entries[c]);
+	}
+	return true;
+}
+
+void RecordingReader::ScanChunks()
+{
+	uint64_t offset = sizeof(RecordingFileHeader);
+
+	index.clear();
+	while (ValidChunk(offset, mapSize))
+	{
+		const RecordingChunkHeader *header = (const RecordingChunkHeader *)(map + offset);
+		RecordingIndexEntry entry;
+
+		entry.offset = offset;
+		entry.startNs = header->startNs;
+		entry.endNs = header->endNs;
+		entry.dataPackets = header->dataPackets;
+		entry.positionPackets = header->positionPackets;
+		index.push_back(entry);
+		offset += header->length;
+	}
+}
+
+size_t RecordingReader::Chunks() const
+{
+	return index.size();
+}
+
+const RecordingIndexEntry &RecordingReader::Index(size_t chunk) const
+{
+	return index[chunk];
+}
+
+static bool EndsBefore(const RecordingIndexEntry &entry, uint64_t timeNs)
+{
+	return entry.endNs < timeNs;
+}
+
+size_t RecordingReader::FindChunk(uint64_t timeNs) const
+{
+	return std::lower_bound(index.begin(), index.end(), timeNs, EndsBefore) - index.begin();
+}
+
+void RecordingReader::ReadChunk(size_t chunk, RecordingChunk &columns) const
+{
+	const unsigned char *base = map + index[chunk].offset;
+	const RecordingChunkHeader *header = (const RecordingChunkHeader *)base;
+	uint64_t sizes[RECORDING_COLUMNS];
+	uint64_t offsets[RECORDING_COLUMNS];
+
+	ChunkLayout(header->records, header->dataPackets, header->positionPackets, sizes, offsets);
+	columns.records = header->records;
+	columns.dataPackets = header->dataPackets;
+	columns.positionPackets = header->positionPackets;
+	columns.startNs = header->startNs;
+	columns.endNs = header->endNs;
+	columns.kind = base + offsets[COLUMN_KIND];
+	columns.captureNs = (const uint64_t *)(base + offsets[COLUMN_CAPTURE_NS]);
+	columns.timestamp = (const uint32_t *)(base + offsets[COLUMN_TIMESTAMP]);
+	columns.sensor = base + offsets[COLUMN_SENSOR];
+	columns.returnMode = base + offsets[COLUMN_RETURN_MODE];
+	columns.productId = base + offsets[COLUMN_PRODUCT_ID];
+	columns.azimuth = (const uint16_t *)(base + offsets[COLUMN_AZIMUTH]);
+	columns.distance = (const uint16_t *)(base + offsets[COLUMN_DISTANCE]);
+	columns.reflectivity = base + offsets[COLUMN_REFLECTIVITY];
+	columns.positionCaptureNs = (const uint64_t *)(base + offsets[COLUMN_POSITION_CAPTURE_NS]);
+	columns.positionTimestamp = (const uint32_t *)(base + offsets[COLUMN_POSITION_TIMESTAMP]);
+	columns.positionSensor = base + offsets[COLUMN_POSITION_SENSOR];
+	columns.nmeaLen = (const uint16_t *)(base + offsets[COLUMN_NMEA_LEN]);
+	columns.nmea = (const char *)(base + offsets[COLUMN_NMEA]);
+}
+
+void RecordingReader::GetDataPacket(const RecordingChunk &columns, uint32_t p, DataPacket &packet)
+{
+	packet.timestamp = columns.timestamp[p];
+	packet.returnMode = columns.returnMode[p];
+	packet.productId = columns.productId[p];
+	packet.model = SensorModelFromProductId(packet.productId);
+	packet.returnsPerFiring = (packet.returnMode == RETURN_MODE_DUAL) ? 2 : 1;
+	packet.firings = BLOCKS_PER_PACKET / packet.returnsPerFiring;
+
+	uint32_t resolution = SensorModelDistanceResolution(packet.model);
+	for (int b = 0; b < BLOCKS_PER_PACKET; b++)
+	{
+		DataBlock &block = packet.blocks[b];
+		const uint16_t *d = columns.distance + (size_t)p * RETURNS_PER_PACKET + b * CHANNELS_PER_BLOCK;
+
+		block.azimuth = columns.azimuth[(size_t)p * BLOCKS_PER_PACKET + b];
+		for (int c = 0; c < CHANNELS_PER_BLOCK; c++)
+			block.distance[c] = (uint32_t)d[c] * resolution;
+		memcpy(block.reflectivity, columns.reflectivity + (size_t)p * RETURNS_PER_PACKET + b * CHANNELS_PER_BLOCK,
+			CHANNELS_PER_BLOCK);
+	}
+}
+
+void RecordingReader::GetPositionPacket(const RecordingChunk &columns, uint32_t p, PositionPacket &packet)
+{
+	packet.timestamp = columns.positionTimestamp[p];
+	packet.nmea = columns.nmea + (size_t)p * RECORDING_NMEA_LEN;
+	packet.nmeaLen = columns.nmeaLen[p];
+}
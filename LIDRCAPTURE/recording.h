@@ -0,0 +1,223 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "buffer_pool.h"
+#include "packet_decoder.h"
+
+/*Binary recording of decoded packets (.lrec), the compact replacement of LIDAR_data.txt.
+
+layout, every number little endian:
+	file header	RecordingFileHeader
+	chunk		RecordingChunkHeader, then the columns of the chunk
+	...
+	index		one RecordingIndexEntry per chunk
+	trailer		RecordingTrailer
+
+a chunk holds up to RECORDING_CHUNK_PACKETS data packets and the position packets that arrived in between. inside a
+chunk every field is stored as one column (see RecordingChunk), each column starting on a 16 byte boundary of the
+file, so a memory mapped chunk is read in place with no parsing. distances are stored as the raw 16 bit values the
+sensor sent, the per-return azimuths and times are not stored at all: they follow from the block azimuths, the
+packet times and the model (see ComputePointTiming). the index and trailer are only written on Close; a recording
+that was cut short is still readable, the reader then walks the chunks from the start.*/
+
+#define RECORDING_MAGIC "LIDRREC1"
+#define RECORDING_CHUNK_MAGIC "CHNK"
+#define RECORDING_TRAILER_MAGIC "LIDRIDX1"
+#define RECORDING_VERSION 1
+/*data and position packets per chunk*/
+#define RECORDING_CHUNK_PACKETS 1024
+#define RECORDING_CHUNK_POSITIONS 64
+/*chunks in the pool of the writer, one being filled and the rest waiting for or at the writer thread*/
+#define RECORDING_CHUNKS 4
+/*bytes of the position packet stored from the start of the NMEA sentence, the whole rest of the packet*/
+#define RECORDING_NMEA_LEN POSITION_NMEA_LEN
+
+/*values of the record kind column*/
+#define RECORD_DATA 0
+#define RECORD_POSITION 1
+
+struct RecordingFileHeader
+{
+	char magic[8];	//RECORDING_MAGIC
+	uint32_t version;
+	uint32_t chunkPackets;	//RECORDING_CHUNK_PACKETS of the writer
+	uint64_t createdNs;	//wall clock when the recording was opened, nanoseconds since the epoch
+	uint64_t reserved;
+};
+
+struct RecordingChunkHeader
+{
+	char magic[4];	//RECORDING_CHUNK_MAGIC
+	uint32_t records;	//data and position packets in arrival order
+	uint32_t dataPackets;
+	uint32_t positionPackets;
+	uint64_t startNs;	//capture time of the first and last packet of the chunk
+	uint64_t endNs;
+	uint64_t length;	//bytes of the chunk including this header, a multiple of 16
+	uint64_t reserved;
+};
+
+struct RecordingIndexEntry
+{
+	uint64_t offset;	//of the chunk header from the start of the file
+	uint64_t startNs;
+	uint64_t endNs;
+	uint32_t dataPackets;
+	uint32_t positionPackets;
+};
+
+struct RecordingTrailer
+{
+	uint64_t indexOffset;
+	uint32_t chunks;
+	uint32_t reserved;
+	char magic[8];	//RECORDING_TRAILER_MAGIC
+};
+
+/*the columns of one chunk as pointers into the mapped file, in the order they are stored*/
+struct RecordingChunk
+{
+	uint32_t records;
+	uint32_t dataPackets;
+	uint32_t positionPackets;
+	uint64_t startNs;
+	uint64_t endNs;
+
+	const uint8_t *kind;	//RECORD_DATA or RECORD_POSITION, one per record
+	/*one per data packet*/
+	const uint64_t *captureNs;	//nanoseconds since the epoch
+	const uint32_t *timestamp;	//microseconds past the hour
+	const uint8_t *sensor;
+	const uint8_t *returnMode;
+	const uint8_t *productId;
+	/*BLOCKS_PER_PACKET per data packet*/
+	const uint16_t *azimuth;
+	/*BLOCKS_PER_PACKET * CHANNELS_PER_BLOCK per data packet, block by block*/
+	const uint16_t *distance;	//raw units of the model, 0 is no return
+	const uint8_t *reflectivity;
+	/*one per position packet*/
+	const uint64_t *positionCaptureNs;
+	const uint32_t *positionTimestamp;
+	const uint8_t *positionSensor;
+	const uint16_t *nmeaLen;
+	const char *nmea;	//RECORDING_NMEA_LEN per position packet
+};
+
+/*Appends decoded packets to a recording.
+The columns of a chunk are preallocated for a full chunk, adding a packet is a handful of copies into them. a full
+chunk is handed through a lock-free queue to a writer thread that writes it with a single writev. the capture never
+waits for the disk: when every chunk of the pool is still with the writer, the chunk just filled is dropped and
+counted instead. one thread adds all packets.*/
+class RecordingWriter
+{
+public:
+	RecordingWriter();
+	~RecordingWriter();
+
+	/*creates the file, writes its header and starts the writer. returns false and fills errbuf (CAPTURE_ERRBUF_SIZE
+	bytes) on failure.*/
+	bool Open(const char *path, char *errbuf);
+	/*capture thread: add a decoded packet*/
+	void AddDataPacket(const DataPacket &packet, uint64_t captureNs, unsigned int sensor);
+	void AddPositionPacket(const PositionPacket &packet, uint64_t captureNs, unsigned int sensor);
+	/*hands over the last chunk, waits for the writer, writes the index and the trailer and closes the file*/
+	bool Close(char *errbuf);
+
+	/*prints the packets recorded and dropped and the size of the file*/
+	void PrintStats(FILE *out) const;
+
+private:
+	/*the columns of one chunk*/
+	struct Chunk
+	{
+		RecordingChunkHeader header;
+		std::vector<uint8_t> kind;
+		std::vector<uint64_t> captureNs;
+		std::vector<uint32_t> timestamp;
+		std::vector<uint8_t> sensor;
+		std::vector<uint8_t> returnMode;
+		std::vector<uint8_t> productId;
+		std::vector<uint16_t> azimuth;
+		std::vector<uint16_t> distance;
+		std::vector<uint8_t> reflectivity;
+		std::vector<uint64_t> positionCaptureNs;
+		std::vector<uint32_t> positionTimestamp;
+		std::vector<uint8_t> positionSensor;
+		std::vector<uint16_t> nmeaLen;
+		std::vector<char> nmea;
+
+		Chunk();
+	};
+
+	/*hands the chunk being filled to the writer, or drops it if the pool is empty. with last set it waits for the
+	writer instead.*/
+	void Submit(bool last = false);
+	bool WriteChunk(Chunk &chunk);
+	bool WriteAll(const void *data, size_t len);
+
+	int fd;
+	std::string path;
+	std::vector<Chunk *> chunks;	//owns the columns
+	BufferPool<Chunk> pool;
+
+	/*capture thread statistics*/
+	uint64_t packets;
+	uint64_t droppedChunks;
+	uint64_t droppedPackets;
+	/*writer state, only read by the capture thread after it joined the writer*/
+	uint64_t offset;	//file size so far
+	std::vector<RecordingIndexEntry> index;
+	int writeError;	//errno of the first failed write, 0 if none
+
+	RecordingWriter(const RecordingWriter &);
+	RecordingWriter &operator=(const RecordingWriter &);
+};
+
+/*Reads a recording through a memory mapping.
+the index gives the time range of every chunk, so a time range is found without touching the chunks outside it.*/
+class RecordingReader
+{
+public:
+	RecordingReader();
+	~RecordingReader();
+
+	/*maps the file and loads its index, rebuilding it from the chunks if the recording was not closed. returns false
+	and fills errbuf (CAPTURE_ERRBUF_SIZE bytes) if the file is not a recording or is corrupt.*/
+	bool Open(const char *path, char *errbuf);
+	void Close();
+
+	size_t Chunks() const;
+	const RecordingIndexEntry &Index(size_t chunk) const;
+	/*first chunk that ends at or after timeNs, Chunks() if there is none*/
+	size_t FindChunk(uint64_t timeNs) const;
+	/*points the columns of chunk at the mapped data*/
+	void ReadChunk(size_t chunk, RecordingChunk &columns) const;
+
+	/*rebuild data packet p / position packet p of a chunk as the decoder produced it. the position packet points into
+	the mapping.*/
+	static void GetDataPacket(const RecordingChunk &columns, uint32_t p, DataPacket &packet);
+	static void GetPositionPacket(const RecordingChunk &columns, uint32_t p, PositionPacket &packet);
+
+private:
+	/*reads the index behind the chunks, false if the recording has none or it does not match the file*/
+	bool LoadIndex();
+	/*builds the index by walking the chunks from the start, up to the first incomplete one*/
+	void ScanChunks();
+	/*true if a whole, consistent chunk starts at offset and ends before limit*/
+	bool ValidChunk(uint64_t offset, uint64_t limit) const;
+
+	int fd;
+	const unsigned char *map;
+	size_t mapSize;
+	std::vector<RecordingIndexEntry> index;
+
+	RecordingReader(const RecordingReader &);
+	RecordingReader &operator=(const RecordingReader &);
+};
+
+#endif
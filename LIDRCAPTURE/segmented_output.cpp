@@ -0,0 +1,142 @@
+#include "segmented_output.h"
+
+#include <errno.h>
+#include <float.h>
+#include <string.h>
+#include "capture.h"
+
+SegmentedOutput::SegmentedOutput(const char *prefix, const char *extension, uint64_t maxNs, uint64_t maxBytes)
+	: prefix(prefix), extension(extension), maxNs(maxNs), maxBytes(maxBytes), stream(NULL), index(NULL),
+	indexPath(std::string(prefix) + ".idx"), segment(0), startNs(0), endNs(0), packets(0), startBytes(0)
+{
+	SegmentPath(0, path);
+}
+
+SegmentedOutput::~SegmentedOutput()
+{
+	char errbuf[CAPTURE_ERRBUF_SIZE];
+
+	if (index != NULL)
+		Close(errbuf);
+}
+
+void SegmentedOutput::SegmentPath(uint32_t segment, char *path) const
+{
+	snprintf(path, SEGMENT_PATH_LEN, "%s_%06u.%s", prefix.c_str(), segment, extension.c_str());
+}
+
+const char *SegmentedOutput::Path() const
+{
+	return path;
+}
+
+bool SegmentedOutput::Open(AsyncStreamBuf &stream, char *errbuf)
+{
+	index = fopen(indexPath.c_str(), "w");
+	if (index == NULL)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", indexPath.c_str(), strerror(errno));
+		return false;
+	}
+	fprintf(index, "# file start_ns end_ns packets bytes min_x min_y min_z max_x max_y max_z\n");
+	fflush(index);
+
+	this->stream = &stream;
+	segment = 0;
+	Start(0);
+	return true;
+}
+
+void SegmentedOutput::Start(uint64_t timeNs)
+{
+	startNs = endNs = timeNs;
+	packets = 0;
+	startBytes = stream->Bytes();
+	for (int a = 0; a < 3; a++)
+	{
+		min[a] = FLT_MAX;
+		max[a] = -FLT_MAX;
+	}
+}
+
+void SegmentedOutput::Finish()
+{
+	bool bounded = (min[0] <= max[0]);
+
+	fprintf(index, "%s %llu %llu %llu %llu", path, (unsigned long long)startNs, (unsigned long long)endNs,
+		(unsigned long long)packets, (unsigned long long)(stream->Bytes() - startBytes));
+	for (int a = 0; a < 3; a++)
+		fprintf(index, bounded ? " %.3f" : " nan", min[a]);
+	for (int a = 0; a < 3; a++)
+		fprintf(index, bounded ? " %.3f" : " nan", max[a]);
+	fprintf(index, "\n");
+	fflush(index);
+}
+
+void SegmentedOutput::AddPacket(uint64_t timeNs)
+{
+	bool full = (maxBytes > 0 && stream->Bytes() - startBytes >= maxBytes);
+	bool old = (maxNs > 0 && timeNs >= startNs + maxNs);
+	char next[SEGMENT_PATH_LEN];
+
+	if (packets > 0 && (full || old))
+	{
+		/*the writer thread is far behind when this fails, the segment then just grows*/
+		SegmentPath(segment + 1, next);
+		if (stream->Rotate(next))
+		{
+			Finish();
+			segment++;
+			memcpy(path, next, sizeof(path));
+			Start(timeNs);
+		}
+	}
+	if (packets == 0)
+		startNs = endNs = timeNs;
+	if (timeNs < startNs)
+		startNs = timeNs;
+	if (timeNs > endNs)
+		endNs = timeNs;
+	packets++;
+}
+
+void SegmentedOutput::AddPoints(const PointPacket &points)
+{
+	for (int b = 0; b < BLOCKS_PER_PACKET; b++)
+	{
+		const PointBlock &block = points.blocks[b];
+		for (int c = 0; c < CHANNELS_PER_BLOCK; c++)
+		{
+			if (!block.keep[c])
+				continue;
+			min[0] = (block.x[c] < min[0]) ? block.x[c] : min[0];
+			min[1] = (block.y[c] < min[1]) ? block.y[c] : min[1];
+			min[2] = (block.z[c] < min[2]) ? block.z[c] : min[2];
+			max[0] = (block.x[c] > max[0]) ? block.x[c] : max[0];
+			max[1] = (block.y[c] > max[1]) ? block.y[c] : max[1];
+			max[2] = (block.z[c] > max[2]) ? block.z[c] : max[2];
+		}
+	}
+}
+
+bool SegmentedOutput::Close(char *errbuf)
+{
+	bool ok = true;
+
+	if (index == NULL)
+		return true;
+	Finish();
+	bool failed = (ferror(index) != 0);
+	if (fclose(index) != 0 || failed)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "%s: %s", indexPath.c_str(), strerror(errno));
+		ok = false;
+	}
+	index = NULL;
+	return ok;
+}
+
+uint32_t SegmentedOutput::Segments() const
+{
+	return segment + 1;
+}
@@ -0,0 +1,72 @@
+#ifndef SEGMENTED_OUTPUT_H
+#define SEGMENTED_OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include "async_writer.h"
+#include "point_convert.h"
+
+#define SEGMENT_PATH_LEN 128
+
+/*Splits the text output into segments of at most some seconds of capture time or some bytes, named
+prefix_000000.extension, prefix_000001.extension and so on, and lists them in the session index prefix.idx.
+
+segments are cut between packets, so each starts with the line break in front of its first packet's lines and they
+concatenate back to the single file they replace. the index is plain text, a comment line naming the columns and then
+one line per finished segment: its file, the capture time of its first and last packet in nanoseconds since the
+epoch, its packet count, its bytes and the bounds of its kept points in meters in the sensor frame (nan without
+points). a line is appended as soon as a segment is finished, so the index of a capture that died lists every
+segment but the last.*/
+class SegmentedOutput
+{
+public:
+	/*maxNs or maxBytes 0 does not cut on time or size*/
+	SegmentedOutput(const char *prefix, const char *extension, uint64_t maxNs, uint64_t maxBytes);
+	~SegmentedOutput();
+
+	/*path of the first segment, the stream has to be opened on it before Open*/
+	const char *Path() const;
+	/*creates the index and starts the first segment on stream. returns false and fills errbuf
+	(CAPTURE_ERRBUF_SIZE bytes) if the index cannot be created.*/
+	bool Open(AsyncStreamBuf &stream, char *errbuf);
+	/*capture thread, before a packet is written: moves the stream on to a new segment when the current one is full
+	or spans maxNs, and counts the packet*/
+	void AddPacket(uint64_t timeNs);
+	/*grows the bounds of the current segment by the kept points of a converted packet*/
+	void AddPoints(const PointPacket &points);
+	/*lists the last segment and closes the index, before the stream is closed*/
+	bool Close(char *errbuf);
+
+	uint32_t Segments() const;
+
+private:
+	/*appends the current segment to the index and starts the next*/
+	void Finish();
+	void Start(uint64_t timeNs);
+	void SegmentPath(uint32_t segment, char *path) const;
+
+	std::string prefix;
+	std::string extension;
+	uint64_t maxNs;
+	uint64_t maxBytes;
+	AsyncStreamBuf *stream;
+	FILE *index;
+	std::string indexPath;
+
+	/*the segment being written*/
+	uint32_t segment;
+	char path[SEGMENT_PATH_LEN];
+	uint64_t startNs;
+	uint64_t endNs;
+	uint64_t packets;
+	uint64_t startBytes;	//stream position at its start
+	float min[3];
+	float max[3];
+
+	SegmentedOutput(const SegmentedOutput &);
+	SegmentedOutput &operator=(const SegmentedOutput &);
+};
+
+#endif
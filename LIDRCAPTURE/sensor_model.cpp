@@ -0,0 +1,72 @@
+#include "sensor_model.h"
+
+/*C++11 still needs a definition of every static constexpr member that is used by address, the tables are indexed
+at runtime*/
+constexpr float Vlp16::verticalAngle[Vlp16::channels];
+constexpr float Vlp32c::verticalAngle[Vlp32c::channels];
+constexpr float Hdl32e::verticalAngle[Hdl32e::channels];
+constexpr const char *Vlp16::name;
+constexpr const char *Vlp32c::name;
+constexpr const char *Hdl32e::name;
+
+SensorModelId SensorModelFromProductId(uint8_t productId)
+{
+	switch (productId)
+	{
+	case Vlp16::productId:
+	case 0x23:	//Puck LITE
+	case 0x24:	//Puck Hi-Res
+		return SENSOR_VLP16;
+	case Vlp32c::productId:
+		return SENSOR_VLP32C;
+	case Hdl32e::productId:
+		return SENSOR_HDL32E;
+	default:
+		return SENSOR_UNKNOWN;
+	}
+}
+
+const char *SensorModelName(SensorModelId model)
+{
+	switch (model)
+	{
+	case SENSOR_VLP16:
+		return Vlp16::name;
+	case SENSOR_VLP32C:
+		return Vlp32c::name;
+	case SENSOR_HDL32E:
+		return Hdl32e::name;
+	default:
+		return "unknown";
+	}
+}
+
+int SensorModelChannels(SensorModelId model)
+{
+	switch (model)
+	{
+	case SENSOR_VLP16:
+		return Vlp16::channels;
+	case SENSOR_VLP32C:
+		return Vlp32c::channels;
+	case SENSOR_HDL32E:
+		return Hdl32e::channels;
+	default:
+		return 0;
+	}
+}
+
+uint32_t SensorModelDistanceResolution(SensorModelId model)
+{
+	switch (model)
+	{
+	case SENSOR_VLP16:
+		return Vlp16::distanceResolutionMm;
+	case SENSOR_VLP32C:
+		return Vlp32c::distanceResolutionMm;
+	case SENSOR_HDL32E:
+		return Hdl32e::distanceResolutionMm;
+	default:
+		return 0;
+	}
+}
@@ -0,0 +1,105 @@
+#ifndef SENSOR_MODEL_H
+#define SENSOR_MODEL_H
+
+#include <stdint.h>
+
+/*compile time description of the supported sensors. the decode and convert kernels are templates over one of these,
+so every loop bound and constant is known to the compiler and each model gets its own fully unrolled code. the only
+runtime decision is which instantiation a packet goes to, made once per packet from its product id byte.
+
+all three send the same packet layout (12 blocks of 32 returns), they differ in how the returns map to lasers and
+when each laser fired. a block holds firingsPerBlock firing sequences of the model's channels.*/
+
+/*VLP-16 (Puck). 16 lasers fired one after the other, two firing sequences per block.*/
+struct Vlp16
+{
+	static constexpr const char *name = "VLP-16";
+	static constexpr uint8_t productId = 0x22;
+	static constexpr int channels = 16;
+	static constexpr int firingsPerBlock = 2;
+	static constexpr int simultaneousLasers = 1;	//lasers fired at the same time
+	static constexpr double laserSpacingUs = 2.304;	//time between two laser firings
+	static constexpr double firingCycleUs = 55.296;	//one firing sequence including the recharge time
+	static constexpr uint32_t distanceResolutionMm = 2;
+	static constexpr float verticalAngle[channels] =	//degrees, by laser id
+		{ -15, 1, -13, 3, -11, 5, -9, 7, -7, 9, -5, 11, -3, 13, -1, 15 };
+};
+
+/*VLP-32C (Ultra Puck). 32 lasers fired two at a time, one firing sequence per block, 4 mm distance units.*/
+struct Vlp32c
+{
+	static constexpr const char *name = "VLP-32C";
+	static constexpr uint8_t productId = 0x28;
+	static constexpr int channels = 32;
+	static constexpr int firingsPerBlock = 1;
+	static constexpr int simultaneousLasers = 2;
+	static constexpr double laserSpacingUs = 2.304;
+	static constexpr double firingCycleUs = 55.296;
+	static constexpr uint32_t distanceResolutionMm = 4;
+	static constexpr float verticalAngle[channels] =
+	{
+		-25, -1, -1.667f, -15.639f, -11.31f, 0, -0.667f, -8.843f,
+		-7.254f, 0.333f, -0.333f, -6.148f, -5.333f, 1.333f, 0.667f, -4,
+		-4.667f, 1.667f, 1, -3.667f, -3.333f, 3.333f, 2.333f, -2.667f,
+		-3, 7, 4.667f, -2.333f, -2, 15, 10.333f, -1.333f
+	};
+};
+
+/*HDL-32E. 32 lasers fired one after the other, one firing sequence per block.*/
+struct Hdl32e
+{
+	static constexpr const char *name = "HDL-32E";
+	static constexpr uint8_t productId = 0x21;
+	static constexpr int channels = 32;
+	static constexpr int firingsPerBlock = 1;
+	static constexpr int simultaneousLasers = 1;
+	static constexpr double laserSpacingUs = 1.152;
+	static constexpr double firingCycleUs = 46.08;
+	static constexpr uint32_t distanceResolutionMm = 2;
+	static constexpr float verticalAngle[channels] =
+	{
+		-30.67f, -9.33f, -29.33f, -8, -28, -6.67f, -26.67f, -5.33f,
+		-25.33f, -4, -24, -2.67f, -22.67f, -1.33f, -21.33f, 0,
+		-20, 1.33f, -18.67f, 2.67f, -17.33f, 4, -16, 5.33f,
+		-14.67f, 6.67f, -13.33f, 8, -12, 9.33f, -10.67f, 10.67f
+	};
+};
+
+/*microseconds between the start of a block and the firing of its return r*/
+template <class Model>
+constexpr double ReturnOffsetUs(int r)
+{
+	return (r / Model::channels) * Model::firingCycleUs
+		+ ((r % Model::channels) / Model::simultaneousLasers) * Model::laserSpacingUs;
+}
+
+/*microseconds between the starts of two blocks*/
+template <class Model>
+constexpr double BlockDurationUs()
+{
+	return Model::firingsPerBlock * Model::firingCycleUs;
+}
+
+/*the models whose packets can be decoded, for switching on the product id byte*/
+enum SensorModelId
+{
+	SENSOR_UNKNOWN,
+	SENSOR_VLP16,
+	SENSOR_VLP32C,
+	SENSOR_HDL32E
+};
+
+/*maps the product id byte of a data packet to its model. the Puck LITE and Puck Hi-Res report their own ids but
+send VLP-16 packets.*/
+SensorModelId SensorModelFromProductId(uint8_t productId);
+
+/*name of the model for messages, "unknown" for SENSOR_UNKNOWN*/
+const char *SensorModelName(SensorModelId model);
+
+/*number of lasers of the model, 0 for SENSOR_UNKNOWN*/
+int SensorModelChannels(SensorModelId model);
+
+/*millimeters per distance unit of the model, 0 for SENSOR_UNKNOWN*/
+uint32_t SensorModelDistanceResolution(SensorModelId model);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+/*bounded lock-free queue between exactly one producer thread and one consumer thread. neither side ever blocks or
+takes a lock: Push fails when the queue is full and Pop when it is empty, and the caller decides what to do.
+meant for handing pointers to preallocated buffers from one stage to the next.*/
+template <class T>
+class SpscQueue
+{
+public:
+	/*capacity is rounded up to a power of two*/
+	explicit SpscQueue(size_t capacity)
+		: head(0), tail(0)
+	{
+		size_t size = 1;
+		while (size < capacity)
+			size <<= 1;
+		slots.resize(size);
+		mask = size - 1;
+	}
+
+	/*producer side. returns false if the queue is full.*/
+	bool Push(const T &item)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == slots.size())
+			return false;
+		slots[t & mask] = item;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	/*consumer side. returns false if the queue is empty.*/
+	bool Pop(T &item)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+			return false;
+		item = slots[h & mask];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	/*only exact when called from the consumer side with the producer idle*/
+	bool Empty() const
+	{
+		return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+	}
+
+private:
+	/*head and tail are written by different threads, the padding keeps them on separate cache lines*/
+	std::atomic<size_t> head;	//next slot to pop, written by the consumer
+	char headPad[64 - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> tail;	//next slot to push, written by the producer
+	char tailPad[64 - sizeof(std::atomic<size_t>)];
+	std::vector<T> slots;
+	size_t mask;
+};
+
+#endif
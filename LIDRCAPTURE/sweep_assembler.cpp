@@ -0,0 +1,180 @@
+#include "sweep_assembler.h"
+
+#define HALF_TURN (AZIMUTH_STEPS / 2)
+
+Sweep::Sweep(size_t capacity)
+	: x(capacity), y(capacity), z(capacity), reflectivity(capacity), laser(capacity), returnIndex(capacity),
+	azimuth(capacity), timeNs(capacity), count(0), capacity(capacity)
+{
+}
+
+SweepAssembler::SweepAssembler(unsigned int sensor, unsigned int cutAngle, size_t points, size_t poolSize)
+	: sensor(sensor), cutAngle(cutAngle % AZIMUTH_STEPS), freeSweeps(poolSize), fullSweeps(poolSize), current(NULL),
+	sequence(0), droppedSweeps(0), haveAzimuth(false), lastAzimuth(0), lastPacketNs(0), finished(false)
+{
+	/*one buffer is always being filled, the rest wait in the free queue*/
+	for (size_t s = 0; s < poolSize + 1; s++)
+		pool.push_back(new Sweep(points));
+	for (size_t s = 1; s < pool.size(); s++)
+		freeSweeps.Push(pool[s]);
+	current = pool[0];
+	ResetSweep(false);
+}
+
+SweepAssembler::~SweepAssembler()
+{
+	for (size_t s = 0; s < pool.size(); s++)
+		delete pool[s];
+}
+
+void SweepAssembler::ResetSweep(bool complete)
+{
+	SweepInfo &info = current->info;
+
+	current->count = 0;
+	info.sequence = sequence;
+	info.sensor = sensor;
+	info.model = SENSOR_UNKNOWN;
+	info.dualReturn = false;
+	info.complete = complete;
+	info.startNs = 0;
+	info.endNs = 0;
+	info.packets = 0;
+	info.missingPackets = 0;
+	info.droppedPoints = 0;
+	info.deskewed = false;
+}
+
+void SweepAssembler::Publish(bool complete)
+{
+	Sweep *next;
+
+	if (current->info.packets > 0)
+	{
+		if (freeSweeps.Pop(next))
+		{
+			fullSweeps.Push(current);	//cannot fail, the queue has room for the whole pool
+			current = next;
+		}
+		else
+			droppedSweeps++;
+		sequence++;
+	}
+	ResetSweep(complete);
+}
+
+void SweepAssembler::AppendBlock(const DataBlock &block, const uint16_t *azimuth, const uint64_t *timeNs,
+	const PointBlock &points, int returnIndex, int channels)
+{
+	Sweep &s = *current;
+	size_t n = s.count;
+
+	if (n + CHANNELS_PER_BLOCK > s.capacity)
+	{
+		for (int c = 0; c < CHANNELS_PER_BLOCK; c++)
+			s.info.droppedPoints += points.keep[c];
+		return;
+	}
+
+	/*every return is written and the write position only moves on for the returns the filter kept, so the copy has no
+	branches. the capacity check above leaves room for the whole block.*/
+	for (int c = 0; c < CHANNELS_PER_BLOCK; c++)
+	{
+		s.x[n] = points.x[c];
+		s.y[n] = points.y[c];
+		s.z[n] = points.z[c];
+		s.reflectivity[n] = block.reflectivity[c];
+		s.laser[n] = (uint8_t)(c % channels);
+		s.returnIndex[n] = (uint8_t)returnIndex;
+		s.azimuth[n] = azimuth[c];
+		s.timeNs[n] = timeNs[c];
+		n += points.keep[c];
+	}
+
+	if (s.count == 0 && n > 0)
+		s.info.startNs = s.timeNs[0];
+	if (n > 0)
+		s.info.endNs = s.timeNs[n - 1];
+	s.count = n;
+}
+
+void SweepAssembler::AddPacket(const DataPacket &packet, const PointTiming &timing, const PointPacket &points)
+{
+	const int returns = packet.returnsPerFiring;
+	const int firings = packet.firings;
+	const int channels = SensorModelChannels(packet.model);
+	const uint64_t packetNs = timing.timeNs[0][0];
+	bool contributed = false;
+
+	if (channels == 0)
+		return;
+
+	/*the sensor sends its packets at a fixed rate, a longer gap than one packet's worth of firings means packets
+	went missing*/
+	uint64_t intervalNs = (timing.timeNs[(firings - 1) * returns][0] - packetNs) * firings / (firings - 1);
+	if (lastPacketNs != 0 && packetNs > lastPacketNs && intervalNs > 0)
+	{
+		uint64_t seen = (packetNs - lastPacketNs + intervalNs / 2) / intervalNs;
+		if (seen > 1)
+			current->info.missingPackets += (unsigned int)(seen - 1);
+	}
+	lastPacketNs = packetNs;
+
+	for (int f = 0; f < firings; f++)
+	{
+		unsigned int azimuth = timing.azimuth[f * returns][0];
+
+		/*measured from the cut angle the azimuth only ever grows, until it jumps back by about a full turn when the
+		cut is passed. small steps back are jitter and do not end the sweep.*/
+		if (haveAzimuth)
+		{
+			unsigned int from = (lastAzimuth + AZIMUTH_STEPS - cutAngle) % AZIMUTH_STEPS;
+			unsigned int to = (azimuth + AZIMUTH_STEPS - cutAngle) % AZIMUTH_STEPS;
+			if (to < from && from - to > HALF_TURN)
+			{
+				current->info.packets += contributed;
+				contributed = false;
+				Publish(true);
+			}
+		}
+		lastAzimuth = azimuth;
+		haveAzimuth = true;
+
+		current->info.model = packet.model;
+		current->info.dualReturn = (returns == 2);
+		for (int r = 0; r < returns; r++)
+		{
+			int b = f * returns + r;
+			AppendBlock(packet.blocks[b], timing.azimuth[b], timing.timeNs[b], points.blocks[b],
+				(returns == 2) ? r : 0, channels);
+		}
+		contributed = true;
+	}
+	current->info.packets += contributed;
+}
+
+void SweepAssembler::Finish()
+{
+	Publish(false);
+	finished.store(true, std::memory_order_release);
+}
+
+bool SweepAssembler::Acquire(Sweep *&sweep)
+{
+	return fullSweeps.Pop(sweep);
+}
+
+void SweepAssembler::Release(Sweep *sweep)
+{
+	freeSweeps.Push(sweep);
+}
+
+bool SweepAssembler::Finished() const
+{
+	return finished.load(std::memory_order_acquire) && fullSweeps.Empty();
+}
+
+uint64_t SweepAssembler::DroppedSweeps() const
+{
+	return droppedSweeps.load(std::memory_order_relaxed);
+}
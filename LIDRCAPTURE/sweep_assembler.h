@@ -0,0 +1,108 @@
+#ifndef SWEEP_ASSEMBLER_H
+#define SWEEP_ASSEMBLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "point_convert.h"
+#include "spsc_queue.h"
+
+/*default size of the sweep buffers (a full rotation of any supported sensor in dual return mode at 5 Hz) and number
+of finished sweeps that can wait for or be held by the consumer*/
+#define SWEEP_DEFAULT_POINTS 262144
+#define SWEEP_DEFAULT_POOL 8
+
+/*what is known about a sweep besides its points*/
+struct SweepInfo
+{
+	uint64_t sequence;	//number of the sweep since the assembler was created, gaps are sweeps that were dropped
+	unsigned int sensor;
+	SensorModelId model;
+	bool dualReturn;	//the sensor was in dual return mode, returnIndex tells the returns apart
+	bool complete;	//false for a sweep that did not start at the cut angle (the first one) or was cut short
+	uint64_t startNs;	//time of the first and last point
+	uint64_t endNs;
+	unsigned int packets;	//data packets that contributed points
+	unsigned int missingPackets;	//packets the sensor sent but we did not see, estimated from the packet times
+	size_t droppedPoints;	//points that did not fit into the buffer
+	bool deskewed;	//points have been moved into the sensor frame at endNs, see DeskewSweep
+};
+
+/*the points of one full rotation, stored as one array per field. the arrays are allocated once with room for
+capacity points and recycled through the pool, only the first count entries are valid.*/
+struct Sweep
+{
+	std::vector<float> x;	//meters
+	std::vector<float> y;
+	std::vector<float> z;
+	std::vector<uint8_t> reflectivity;
+	std::vector<uint8_t> laser;	//laser id the point came from
+	std::vector<uint8_t> returnIndex;	//RETURN_INDEX_LAST or RETURN_INDEX_STRONGEST in dual return mode, else 0
+	std::vector<uint16_t> azimuth;	//hundredths of a degree
+	std::vector<uint64_t> timeNs;	//nanoseconds since the epoch
+	size_t count;
+	size_t capacity;
+	SweepInfo info;
+
+	explicit Sweep(size_t capacity);
+};
+
+/*Cuts the stream of converted packets of one sensor into full rotations.
+A sweep ends when the azimuth passes the cut angle. Points go straight into a sweep buffer taken from a fixed pool,
+finished sweeps are handed to the consumer through a lock-free queue and come back through another one when the
+consumer releases them. AddPacket is called from the decoding thread and Acquire/Release from one consumer thread;
+nothing blocks. If the consumer falls so far behind that the pool runs dry the sweep being filled is thrown away and
+refilled, which shows up as a gap in the sequence numbers.*/
+class SweepAssembler
+{
+public:
+	/*cutAngle in hundredths of a degree*/
+	SweepAssembler(unsigned int sensor, unsigned int cutAngle, size_t points = SWEEP_DEFAULT_POINTS,
+		size_t poolSize = SWEEP_DEFAULT_POOL);
+	~SweepAssembler();
+
+	/*producer side: adds the points of a decoded and converted packet*/
+	void AddPacket(const DataPacket &packet, const PointTiming &timing, const PointPacket &points);
+	/*producer side: publishes the sweep being filled and marks the stream as ended*/
+	void Finish();
+
+	/*consumer side: takes the oldest finished sweep, returns false if there is none yet*/
+	bool Acquire(Sweep *&sweep);
+	/*consumer side: gives a sweep back to the pool once the consumer is done with it*/
+	void Release(Sweep *sweep);
+	/*consumer side: true once Finish was called and every sweep has been acquired*/
+	bool Finished() const;
+
+	/*number of sweeps thrown away because the pool was empty*/
+	uint64_t DroppedSweeps() const;
+
+private:
+	/*hands the current sweep to the consumer and starts the next one in a buffer from the pool. if the pool is empty
+	the current sweep is dropped and its buffer reused.*/
+	void Publish(bool complete);
+	/*clears the current sweep for reuse*/
+	void ResetSweep(bool complete);
+	/*copies the points of one block to the end of the current sweep*/
+	void AppendBlock(const DataBlock &block, const uint16_t *azimuth, const uint64_t *timeNs, const PointBlock &points,
+		int returnIndex, int channels);
+
+	unsigned int sensor;
+	unsigned int cutAngle;
+	std::vector<Sweep *> pool;	//owns the buffers
+	SpscQueue<Sweep *> freeSweeps;	//consumer to producer
+	SpscQueue<Sweep *> fullSweeps;	//producer to consumer
+	Sweep *current;
+	uint64_t sequence;
+	std::atomic<uint64_t> droppedSweeps;
+	bool haveAzimuth;
+	unsigned int lastAzimuth;	//azimuth of the last firing added
+	uint64_t lastPacketNs;	//time of the first firing of the last packet, 0 before the first
+	std::atomic<bool> finished;
+
+	/*the pool owns raw pointers*/
+	SweepAssembler(const SweepAssembler &);
+	SweepAssembler &operator=(const SweepAssembler &);
+};
+
+#endif
@@ -0,0 +1,33 @@
+# Golden file test of LIDAR_data.txt: replays INPUT with PROGRAM in an empty WORKDIR and compares the text it writes
+# with EXPECTED byte for byte. with CONVERT set the replay writes a binary recording (-o rec) instead, and the text is
+# the one -T converts it to.
+#
+# cmake -DPROGRAM=... -DINPUT=... -DEXPECTED=... -DWORKDIR=... [-DCONVERT=1] -P golden_text.cmake
+
+file(REMOVE_RECURSE "${WORKDIR}")
+file(MAKE_DIRECTORY "${WORKDIR}")
+
+if(CONVERT)
+    set(REPLAY_ARGS -r "${INPUT}" -o rec)
+else()
+    set(REPLAY_ARGS -r "${INPUT}")
+endif()
+execute_process(COMMAND "${PROGRAM}" ${REPLAY_ARGS} WORKING_DIRECTORY "${WORKDIR}" RESULT_VARIABLE result
+    OUTPUT_QUIET ERROR_VARIABLE errors)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "replaying ${INPUT} failed (${result}):\n${errors}")
+endif()
+
+if(CONVERT)
+    execute_process(COMMAND "${PROGRAM}" -T LIDAR_data.lrec WORKING_DIRECTORY "${WORKDIR}" RESULT_VARIABLE result
+        OUTPUT_QUIET ERROR_VARIABLE errors)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "converting the recording of ${INPUT} failed (${result}):\n${errors}")
+    endif()
+endif()
+
+execute_process(COMMAND "${CMAKE_COMMAND}" -E compare_files "${WORKDIR}/LIDAR_data.txt" "${EXPECTED}"
+    RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${WORKDIR}/LIDAR_data.txt differs from ${EXPECTED}")
+endif()
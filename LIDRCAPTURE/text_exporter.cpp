@@ -0,0 +1,133 @@
+#include "text_exporter.h"
+
+#include <string.h>
+
+/*"00" to "99"*/
+struct DigitPairs
+{
+	char digits[200];
+
+	DigitPairs()
+	{
+		for (int i = 0; i < 100; i++)
+		{
+			digits[2 * i] = (char)('0' + i / 10);
+			digits[2 * i + 1] = (char)('0' + i % 10);
+		}
+	}
+};
+
+/*every reflectivity already right aligned in its field*/
+struct ReflectivityFields
+{
+	char fields[256][TEXT_FIELD_WIDTH];
+
+	ReflectivityFields()
+	{
+		for (int r = 0; r < 256; r++)
+		{
+			memset(fields[r], ' ', TEXT_FIELD_WIDTH);
+			int v = r;
+			int i = TEXT_FIELD_WIDTH;
+			do
+			{
+				fields[r][--i] = (char)('0' + v % 10);
+				v /= 10;
+			} while (v > 0);
+		}
+	}
+};
+
+static const DigitPairs digitPairs;
+static const ReflectivityFields reflectivityFields;
+
+/*writes v as digits ending at end, returns where they start*/
+static inline char *PutDigits(char *end, uint32_t v)
+{
+	while (v >= 100)
+	{
+		end -= 2;
+		memcpy(end, &digitPairs.digits[(v % 100) * 2], 2);
+		v /= 100;
+	}
+	if (v >= 10)
+	{
+		end -= 2;
+		memcpy(end, &digitPairs.digits[v * 2], 2);
+	}
+	else
+		*--end = (char)('0' + v);
+	return end;
+}
+
+/*v right aligned in TEXT_FIELD_WIDTH columns, what setw(10) does. a 32 bit value never needs more.*/
+static inline void PutField(char *field, uint32_t v)
+{
+	char *start = PutDigits(field + TEXT_FIELD_WIDTH, v);
+	memset(field, ' ', start - field);
+}
+
+TextExporter::TextExporter()
+{
+	Preformat(single, BLOCKS_PER_PACKET, 1);
+	Preformat(dual, BLOCKS_PER_PACKET / 2, 2);
+	memcpy(gps, "GPS= $G", 7);
+}
+
+void TextExporter::Preformat(char *text, int firings, int returns)
+{
+	for (int f = 0; f < firings; f++)
+	{
+		char *line = text + f * TEXT_FIRING_LEN(returns);
+
+		memset(line, ' ', TEXT_FIRING_LEN(returns));
+		memcpy(line, "\nangle= ", TEXT_ANGLE_PREFIX_LEN);
+	}
+	memcpy(text + firings * TEXT_FIRING_LEN(returns), "\ntime= ", 7);
+}
+
+void TextExporter::WriteDataPacket(const DataPacket &packet, std::ostream &out)
+{
+	int returns = packet.returnsPerFiring;
+	char *text = (returns == 2) ? dual : single;
+	size_t firingLen = TEXT_FIRING_LEN(returns);
+
+	for (int f = 0; f < packet.firings; f++)
+	{
+		char *line = text + f * firingLen;
+
+		PutField(line + TEXT_ANGLE_PREFIX_LEN, FiringReturn(packet, f, 0).azimuth);
+		for (int r = 0; r < returns; r++)
+		{
+			const DataBlock &block = FiringReturn(packet, f, r);
+			/*channel c of return r sits at c * returns + r after the azimuth*/
+			char *field = line + TEXT_ANGLE_PREFIX_LEN + TEXT_FIELD_WIDTH + 1 + r * TEXT_RETURN_LEN + 1;
+
+			for (int c = 0; c < CHANNELS_PER_BLOCK; c++)
+			{
+				PutField(field, block.distance[c]);
+				memcpy(field + TEXT_FIELD_WIDTH + 1, reflectivityFields.fields[block.reflectivity[c]],
+					TEXT_FIELD_WIDTH);
+				field += returns * TEXT_RETURN_LEN;
+			}
+		}
+	}
+
+	/*the time has no field width, its digits are moved up to the label*/
+	char digits[10];
+	char *start = PutDigits(digits + sizeof(digits), packet.timestamp);
+	char *time = text + packet.firings * firingLen + 7;
+	size_t timeLen = digits + sizeof(digits) - start;
+	memcpy(time, start, timeLen);
+	out.write(text, time + timeLen - text);
+}
+
+void TextExporter::WritePositionPacket(const PositionPacket &position, std::ostream &out)
+{
+	/*the state machine only picked up "$G" sentences and copied the 84 bytes after the "$G" whatever they were. the
+	padding behind the sentence is part of the packet, so reading past nmeaLen stays inside it.*/
+	if (position.nmeaLen < 2 || position.nmea[0] != '$' || position.nmea[1] != 'G')
+		return;
+	memcpy(gps + 7, position.nmea + 2, TEXT_GPS_BYTES);
+	out.write(gps, TEXT_GPS_LEN);
+}
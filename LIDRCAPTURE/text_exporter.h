@@ -0,0 +1,51 @@
+#ifndef TEXT_EXPORTER_H
+#define TEXT_EXPORTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ostream>
+#include "packet_decoder.h"
+
+/*one firing line of LIDAR_data.txt: "\nangle= ", the azimuth, a space, then per channel and return a space, the
+distance, a space and the reflectivity, every number right aligned in TEXT_FIELD_WIDTH columns*/
+#define TEXT_FIELD_WIDTH 10
+#define TEXT_ANGLE_PREFIX_LEN 8	//"\nangle= "
+#define TEXT_RETURN_LEN (1 + TEXT_FIELD_WIDTH + 1 + TEXT_FIELD_WIDTH)
+#define TEXT_FIRING_LEN(returns) (TEXT_ANGLE_PREFIX_LEN + TEXT_FIELD_WIDTH + 1 + CHANNELS_PER_BLOCK * (returns) \
+	* TEXT_RETURN_LEN)
+/*"\ntime= " and a 32 bit timestamp*/
+#define TEXT_TIME_MAX_LEN (7 + 10)
+/*"GPS= $G" and the 84 bytes after it*/
+#define TEXT_GPS_BYTES 84
+#define TEXT_GPS_LEN (7 + TEXT_GPS_BYTES)
+
+/*Writes decoded packets in the text format of LIDAR_data.txt, the one the state machine produces, without going
+through the formatting of ostream.
+every number of a firing line fits its 10 columns, so the lines of a packet have the same length and layout whatever
+the values: the whole packet is kept preformatted, one buffer per return mode with the labels and separators filled in
+once, and only the fields are overwritten. a field is written from the right two digits at a time out of a table of
+digit pairs, and reflectivities are copied whole out of a table of all 256 fields. the finished packet goes to the
+stream with a single write, where the AsyncStreamBuf of the capture adds it to its 4 MB buffers.
+keeps its buffers between calls, use one per thread.*/
+class TextExporter
+{
+public:
+	TextExporter();
+
+	/*same output as the angle= and time= lines of the state machine. in dual return mode there is one angle= line per
+	firing with the last and the strongest return of each channel side by side.*/
+	void WriteDataPacket(const DataPacket &packet, std::ostream &out);
+	/*same output as the GPS= line of the state machine*/
+	void WritePositionPacket(const PositionPacket &position, std::ostream &out);
+
+private:
+	/*the preformatted packet of single and dual return mode*/
+	char single[BLOCKS_PER_PACKET * TEXT_FIRING_LEN(1) + TEXT_TIME_MAX_LEN];
+	char dual[BLOCKS_PER_PACKET / 2 * TEXT_FIRING_LEN(2) + TEXT_TIME_MAX_LEN];
+	char gps[TEXT_GPS_LEN];
+
+	/*fills in the labels and separators of a preformatted packet*/
+	static void Preformat(char *text, int firings, int returns);
+};
+
+#endif
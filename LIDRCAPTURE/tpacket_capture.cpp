@@ -0,0 +1,199 @@
+#include "tpacket_capture.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+
+/*size of one frame slot; only used by the kernel for sanity checks in V3, frames are packed inside the blocks*/
+#define TPACKET_FRAME_SIZE 2048
+
+TPacketCapture::TPacketCapture()
+	: fd(-1), ring(NULL), ringSize(0), blockSize(0), blockCount(0), curBlock(0)
+{
+}
+
+TPacketCapture::~TPacketCapture()
+{
+	Close();
+}
+
+bool TPacketCapture::Open(const char *device, char *errbuf, const struct sock_fprog *filter, unsigned int blockSize,
+	unsigned int blockCount, unsigned int blockTimeoutMs)
+{
+	Close();
+
+	fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+	if (fd < 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "socket(AF_PACKET): %s", strerror(errno));
+		return false;
+	}
+
+	if (filter != NULL && setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, filter, sizeof(*filter)) < 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "SO_ATTACH_FILTER: %s", strerror(errno));
+		Close();
+		return false;
+	}
+
+	int version = TPACKET_V3;
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "PACKET_VERSION: %s", strerror(errno));
+		Close();
+		return false;
+	}
+
+	struct tpacket_req3 req;
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = blockSize;
+	req.tp_block_nr = blockCount;
+	req.tp_frame_size = TPACKET_FRAME_SIZE;
+	req.tp_frame_nr = (blockSize / TPACKET_FRAME_SIZE) * blockCount;
+	req.tp_retire_blk_tov = blockTimeoutMs;
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "PACKET_RX_RING: %s", strerror(errno));
+		Close();
+		return false;
+	}
+
+	ringSize = (size_t)blockSize * blockCount;
+	void *map = mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		/*MAP_LOCKED needs RLIMIT_MEMLOCK headroom, fall back to an unlocked mapping*/
+		map = mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	}
+	if (map == MAP_FAILED)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "mmap of the receive ring: %s", strerror(errno));
+		ringSize = 0;
+		Close();
+		return false;
+	}
+	ring = (unsigned char *)map;
+	this->blockSize = blockSize;
+	this->blockCount = blockCount;
+	curBlock = 0;
+
+	struct sockaddr_ll addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(ETH_P_ALL);
+	addr.sll_ifindex = if_nametoindex(device);
+	if (addr.sll_ifindex == 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "unknown interface %s", device);
+		Close();
+		return false;
+	}
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "bind to %s: %s", device, strerror(errno));
+		Close();
+		return false;
+	}
+
+	/*promiscuous like the pcap_open_live path, the sensor does not send to our MAC address*/
+	struct packet_mreq mreq;
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.mr_ifindex = addr.sll_ifindex;
+	mreq.mr_type = PACKET_MR_PROMISC;
+	if (setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "PACKET_MR_PROMISC on %s: %s", device, strerror(errno));
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+int TPacketCapture::Run(PacketHandler handler, void *user, char *errbuf, const std::atomic<bool> *stop)
+{
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN | POLLERR;
+	pfd.revents = 0;
+
+	for (;;)
+	{
+		struct tpacket_block_desc *desc = (struct tpacket_block_desc *)(ring + (size_t)curBlock * blockSize);
+
+		if (stop != NULL && stop->load(std::memory_order_relaxed))
+			return 0;
+		/*the kernel hands a block over by setting TP_STATUS_USER, sleep until it does*/
+		if ((__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+		{
+			if (poll(&pfd, 1, CAPTURE_STOP_CHECK_MS) < 0 && errno != EINTR)
+			{
+				snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "poll: %s", strerror(errno));
+				return -1;
+			}
+			continue;
+		}
+
+		WalkBlock((unsigned char *)desc, handler, user);
+
+		/*give the block back to the kernel*/
+		__atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+		curBlock = (curBlock + 1) % blockCount;
+	}
+}
+
+void TPacketCapture::WalkBlock(unsigned char *block, PacketHandler handler, void *user)
+{
+	struct tpacket_block_desc *desc = (struct tpacket_block_desc *)block;
+	unsigned int numPkts = desc->hdr.bh1.num_pkts;
+	struct tpacket3_hdr *hdr = (struct tpacket3_hdr *)(block + desc->hdr.bh1.offset_to_first_pkt);
+	RawPacket packet;
+
+	for (unsigned int i = 0; i < numPkts; i++)
+	{
+		packet.data = (const unsigned char *)hdr + hdr->tp_mac;
+		packet.caplen = hdr->tp_snaplen;
+		packet.len = hdr->tp_len;
+		packet.timestampNs = (uint64_t)hdr->tp_sec * 1000000000ULL + hdr->tp_nsec;
+		packet.layer = LAYER_ETHERNET;
+		packet.dstPort = 0;
+		packet.sensor = 0;
+		handler(packet, user);
+
+		hdr = (struct tpacket3_hdr *)((unsigned char *)hdr + hdr->tp_next_offset);
+	}
+}
+
+void TPacketCapture::PrintStats(FILE *out)
+{
+	struct tpacket_stats_v3 stats;
+	socklen_t len = sizeof(stats);
+
+	if (fd < 0 || getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) < 0)
+		return;
+	fprintf(out, "tpacket: %u packets, %u dropped, %u ring freezes\n", stats.tp_packets, stats.tp_drops,
+		stats.tp_freeze_q_cnt);
+}
+
+void TPacketCapture::Close()
+{
+	if (ring != NULL)
+	{
+		munmap(ring, ringSize);
+		ring = NULL;
+		ringSize = 0;
+	}
+	if (fd >= 0)
+	{
+		close(fd);
+		fd = -1;
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef TPACKET_CAPTURE_H
+#define TPACKET_CAPTURE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "capture.h"
+
+struct sock_fprog;
+
+/*Capture backend built on an AF_PACKET socket with a TPACKET_V3 receive ring.
+The kernel fills whole blocks of frames in a ring that is mapped into our address space, so the capture
+loop only makes a syscall when it has caught up with the kernel, and the frames are handed to the
+decoder in place without being copied. A block is given back to the kernel once every frame in it
+has been processed.*/
+class TPacketCapture
+{
+public:
+	TPacketCapture();
+	~TPacketCapture();
+
+	/*opens the socket on the given interface and maps the ring. filter, if given, is attached before the socket is
+	bound so the ring never sees a frame it rejects. blockSize must be a power of two multiple of the page size;
+	blockTimeoutMs is how long the kernel waits before retiring a partially filled block.
+	returns false and fills errbuf (CAPTURE_ERRBUF_SIZE bytes) on failure.*/
+	bool Open(const char *device, char *errbuf, const struct sock_fprog *filter = NULL, unsigned int blockSize = 1 << 20,
+		unsigned int blockCount = 64, unsigned int blockTimeoutMs = 20);
+	/*walks the ring and calls handler for every received frame. returns 0 once stop is set (checked at least every
+	CAPTURE_STOP_CHECK_MS) and -1 on error, with errbuf filled in.*/
+	int Run(PacketHandler handler, void *user, char *errbuf, const std::atomic<bool> *stop = NULL);
+	/*prints the kernel's packet and drop counters (the counters reset on every read)*/
+	void PrintStats(FILE *out);
+	void Close();
+
+private:
+	/*hands every frame of one retired block to the handler*/
+	void WalkBlock(unsigned char *block, PacketHandler handler, void *user);
+
+	int fd;
+	unsigned char *ring;	//start of the mapped ring
+	size_t ringSize;
+	unsigned int blockSize;
+	unsigned int blockCount;
+	unsigned int curBlock;	//next block we expect the kernel to retire
+};
+
+#endif
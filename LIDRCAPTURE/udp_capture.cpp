@@ -0,0 +1,206 @@
+#include "udp_capture.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/*ancillary data per datagram: the receive timestamp and the socket's drop counter*/
+#define UDP_CONTROL_SIZE (CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t)))
+
+UdpCapture::UdpCapture()
+	: buffers(NULL), datagrams(0), syscalls(0)
+{
+	fds[0] = fds[1] = -1;
+	ports[0] = ports[1] = 0;
+	kernelDrops[0] = kernelDrops[1] = 0;
+}
+
+UdpCapture::~UdpCapture()
+{
+	Close();
+}
+
+bool UdpCapture::Open(unsigned short dataPort, unsigned short positionPort, char *errbuf, int rcvBufBytes)
+{
+	Close();
+
+	ports[0] = dataPort;
+	ports[1] = positionPort;
+	for (int s = 0; s < 2; s++)
+	{
+		int on = 1;
+
+		fds[s] = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+		if (fds[s] < 0)
+		{
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "socket: %s", strerror(errno));
+			Close();
+			return false;
+		}
+		setsockopt(fds[s], SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+		/*SO_RCVBUFFORCE ignores net.core.rmem_max but needs CAP_NET_ADMIN, otherwise take what rmem_max allows*/
+		if (setsockopt(fds[s], SOL_SOCKET, SO_RCVBUFFORCE, &rcvBufBytes, sizeof(rcvBufBytes)) < 0)
+			setsockopt(fds[s], SOL_SOCKET, SO_RCVBUF, &rcvBufBytes, sizeof(rcvBufBytes));
+
+		if (setsockopt(fds[s], SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0 ||
+			setsockopt(fds[s], SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) < 0)
+		{
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "socket options on port %u: %s", ports[s], strerror(errno));
+			Close();
+			return false;
+		}
+
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.sin_port = htons(ports[s]);
+		if (bind(fds[s], (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		{
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "bind to UDP port %u: %s", ports[s], strerror(errno));
+			Close();
+			return false;
+		}
+	}
+
+	buffers = new unsigned char[UDP_BATCH * UDP_BUFFER_SIZE];
+	return true;
+}
+
+int UdpCapture::Run(PacketHandler handler, void *user, char *errbuf, const std::atomic<bool> *stop)
+{
+	struct pollfd pfds[2];
+
+	for (int s = 0; s < 2; s++)
+	{
+		pfds[s].fd = fds[s];
+		pfds[s].events = POLLIN;
+		pfds[s].revents = 0;
+	}
+
+	for (;;)
+	{
+		if (stop != NULL && stop->load(std::memory_order_relaxed))
+			return 0;
+		if (poll(pfds, 2, CAPTURE_STOP_CHECK_MS) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "poll: %s", strerror(errno));
+			return -1;
+		}
+
+		for (int s = 0; s < 2; s++)
+		{
+			if (pfds[s].revents & (POLLIN | POLLERR))
+			{
+				if (Drain(s, handler, user, errbuf) < 0)
+					return -1;
+			}
+		}
+	}
+}
+
+int UdpCapture::Drain(int s, PacketHandler handler, void *user, char *errbuf)
+{
+	struct mmsghdr msgs[UDP_BATCH];
+	struct iovec iovs[UDP_BATCH];
+	/*CMSG_FIRSTHDR and CMSG_DATA read the control messages in place, CMSG_SPACE keeps every row aligned as well*/
+	alignas(struct cmsghdr) unsigned char control[UDP_BATCH][UDP_CONTROL_SIZE];
+	RawPacket packet;
+
+	packet.layer = LAYER_UDP_PAYLOAD;
+	packet.dstPort = ports[s];
+	packet.sensor = 0;
+
+	for (;;)
+	{
+		for (int m = 0; m < UDP_BATCH; m++)
+		{
+			iovs[m].iov_base = buffers + m * UDP_BUFFER_SIZE;
+			iovs[m].iov_len = UDP_BUFFER_SIZE;
+			memset(&msgs[m].msg_hdr, 0, sizeof(msgs[m].msg_hdr));
+			msgs[m].msg_hdr.msg_iov = &iovs[m];
+			msgs[m].msg_hdr.msg_iovlen = 1;
+			msgs[m].msg_hdr.msg_control = control[m];
+			msgs[m].msg_hdr.msg_controllen = UDP_CONTROL_SIZE;
+		}
+
+		int count = recvmmsg(fds[s], msgs, UDP_BATCH, MSG_DONTWAIT, NULL);
+		if (count < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			if (errno == EINTR)
+				continue;
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "recvmmsg on port %u: %s", ports[s], strerror(errno));
+			return -1;
+		}
+		syscalls++;
+
+		for (int m = 0; m < count; m++)
+		{
+			struct msghdr *hdr = &msgs[m].msg_hdr;
+			bool stamped = false;
+
+			for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg))
+			{
+				if (cmsg->cmsg_level != SOL_SOCKET)
+					continue;
+				if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+				{
+					struct timespec ts;
+					memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+					packet.timestampNs = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+					stamped = true;
+				}
+				else if (cmsg->cmsg_type == SO_RXQ_OVFL)
+				{
+					memcpy(&kernelDrops[s], CMSG_DATA(cmsg), sizeof(uint32_t));
+				}
+			}
+			if (!stamped)
+			{
+				struct timespec now;
+				clock_gettime(CLOCK_REALTIME, &now);
+				packet.timestampNs = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+			}
+
+			packet.data = (const unsigned char *)iovs[m].iov_base;
+			packet.caplen = msgs[m].msg_len;
+			packet.len = msgs[m].msg_len;
+			handler(packet, user);
+		}
+		datagrams += count;
+
+		/*a short batch means the socket queue is empty*/
+		if (count < UDP_BATCH)
+			return 0;
+	}
+}
+
+void UdpCapture::PrintStats(FILE *out)
+{
+	fprintf(out, "udp: %llu datagrams in %llu recvmmsg calls (%.1f per call), kernel drops %u on port %u, %u on port %u\n",
+		(unsigned long long)datagrams, (unsigned long long)syscalls, syscalls ? (double)datagrams / syscalls : 0.0,
+		kernelDrops[0], ports[0], kernelDrops[1], ports[1]);
+}
+
+void UdpCapture::Close()
+{
+	for (int s = 0; s < 2; s++)
+	{
+		if (fds[s] >= 0)
+		{
+			close(fds[s]);
+			fds[s] = -1;
+		}
+	}
+	delete[] buffers;
+	buffers = NULL;
+}
@@ -0,0 +1,45 @@
+#ifndef UDP_CAPTURE_H
+#define UDP_CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "capture.h"
+
+/*number of datagrams pulled from a socket with one recvmmsg call*/
+#define UDP_BATCH 64
+/*receive buffer per datagram, larger than any packet the sensor sends (1206 byte data, 512 byte position)*/
+#define UDP_BUFFER_SIZE 2048
+
+/*Capture backend that receives the sensor's UDP datagrams on ordinary sockets.
+The data and position ports get a socket each, and every wakeup drains a socket with recvmmsg so dozens
+of datagrams cost one syscall. The kernel only delivers the sensor's datagrams, so no root rights or
+promiscuous mode are needed, and every datagram carries its kernel receive timestamp.*/
+class UdpCapture
+{
+public:
+	UdpCapture();
+	~UdpCapture();
+
+	/*binds the data and position sockets and asks for rcvBufBytes of kernel receive buffer on each.
+	returns false and fills errbuf (CAPTURE_ERRBUF_SIZE bytes) on failure.*/
+	bool Open(unsigned short dataPort, unsigned short positionPort, char *errbuf, int rcvBufBytes = 32 << 20);
+	/*receives datagrams and calls handler for every one of them. returns 0 once stop is set (checked at least every
+	CAPTURE_STOP_CHECK_MS) and -1 on error, with errbuf filled in.*/
+	int Run(PacketHandler handler, void *user, char *errbuf, const std::atomic<bool> *stop = NULL);
+	/*prints datagram, syscall and kernel drop counters*/
+	void PrintStats(FILE *out);
+	void Close();
+
+private:
+	/*reads everything currently queued on socket s. returns -1 on error*/
+	int Drain(int s, PacketHandler handler, void *user, char *errbuf);
+
+	int fds[2];	//data socket, position socket
+	unsigned short ports[2];
+	unsigned char *buffers;	//UDP_BATCH buffers of UDP_BUFFER_SIZE bytes
+	uint64_t datagrams;
+	uint64_t syscalls;
+	uint32_t kernelDrops[2];	//SO_RXQ_OVFL counter last reported per socket
+};
+
+#endif
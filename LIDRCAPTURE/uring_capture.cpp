@@ -0,0 +1,378 @@
+#include "uring_capture.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+
+/*submission queue size, only needs one entry per socket*/
+#define URING_SQ_ENTRIES 64
+/*completion queue size, room for a few wakeups worth of datagrams from every sensor*/
+#define URING_CQ_ENTRIES 4096
+/*buffer group the provided buffers are registered as*/
+#define URING_BUFFER_GROUP 0
+/*ancillary data per datagram: the receive timestamp*/
+#define URING_CONTROL_SIZE CMSG_SPACE(sizeof(struct timespec))
+
+UringCapture::UringCapture()
+	: ringFd(-1), sensorCount(0), sqRing(NULL), sqRingSize(0), sqHead(NULL), sqTail(NULL), sqMask(NULL), sqArray(NULL),
+	sqes(NULL), sqesSize(0), toSubmit(0), cqRing(NULL), cqRingSize(0), cqHead(NULL), cqTail(NULL), cqMask(NULL),
+	cqes(NULL), bufRing(NULL), bufRingSize(0), buffers(NULL), bufTail(0), datagrams(0), enters(0), rearms(0),
+	unstamped(0)
+{
+}
+
+UringCapture::~UringCapture()
+{
+	Close();
+}
+
+bool UringCapture::Open(char *errbuf)
+{
+	Close();
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+	params.cq_entries = URING_CQ_ENTRIES;
+	ringFd = (int)syscall(__NR_io_uring_setup, URING_SQ_ENTRIES, &params);
+	if (ringFd < 0 && errno == EINVAL)
+	{
+		/*older kernels do not know the single issuer and cooperative taskrun hints*/
+		memset(&params, 0, sizeof(params));
+		params.flags = IORING_SETUP_CQSIZE;
+		params.cq_entries = URING_CQ_ENTRIES;
+		ringFd = (int)syscall(__NR_io_uring_setup, URING_SQ_ENTRIES, &params);
+	}
+	if (ringFd < 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "io_uring_setup: %s", strerror(errno));
+		return false;
+	}
+
+	sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (cqRingSize > sqRingSize)
+			sqRingSize = cqRingSize;
+		cqRingSize = 0;
+	}
+	sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+	if (sqRing == MAP_FAILED)
+	{
+		sqRing = NULL;
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "mmap of the submission queue: %s", strerror(errno));
+		Close();
+		return false;
+	}
+	if (cqRingSize == 0)
+		cqRing = sqRing;
+	else
+	{
+		cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+		if (cqRing == MAP_FAILED)
+		{
+			cqRing = NULL;
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "mmap of the completion queue: %s", strerror(errno));
+			Close();
+			return false;
+		}
+	}
+	sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	void *map = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+	if (map == MAP_FAILED)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "mmap of the submission entries: %s", strerror(errno));
+		Close();
+		return false;
+	}
+	sqes = (struct io_uring_sqe *)map;
+
+	unsigned char *sq = (unsigned char *)sqRing;
+	unsigned char *cq = (unsigned char *)cqRing;
+	sqHead = (unsigned int *)(sq + params.sq_off.head);
+	sqTail = (unsigned int *)(sq + params.sq_off.tail);
+	sqMask = (unsigned int *)(sq + params.sq_off.ring_mask);
+	sqArray = (unsigned int *)(sq + params.sq_off.array);
+	cqHead = (unsigned int *)(cq + params.cq_off.head);
+	cqTail = (unsigned int *)(cq + params.cq_off.tail);
+	cqMask = (unsigned int *)(cq + params.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	/*the buffer ring has to be page aligned, an anonymous mapping is*/
+	bufRingSize = URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+	map = mmap(NULL, bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "mmap of the buffer ring: %s", strerror(errno));
+		Close();
+		return false;
+	}
+	bufRing = (struct io_uring_buf_ring *)map;
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)bufRing;
+	reg.ring_entries = URING_BUFFER_COUNT;
+	reg.bgid = URING_BUFFER_GROUP;
+	if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "registering the buffer ring: %s", strerror(errno));
+		Close();
+		return false;
+	}
+
+	buffers = new unsigned char[URING_BUFFER_COUNT * URING_BUFFER_SIZE];
+	bufTail = 0;
+	for (unsigned int bid = 0; bid < URING_BUFFER_COUNT; bid++)
+		RecycleBuffer(bid);
+	PublishBuffers();
+
+	return true;
+}
+
+bool UringCapture::AddSensor(unsigned short dataPort, unsigned short positionPort, char *errbuf, int rcvBufBytes)
+{
+	unsigned short ports[2] = { dataPort, positionPort };
+
+	if (sockets.size() + 2 > URING_SQ_ENTRIES)
+	{
+		snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "too many sensors");
+		return false;
+	}
+
+	for (int s = 0; s < 2; s++)
+	{
+		Socket sock;
+		int on = 1;
+
+		sock.port = ports[s];
+		sock.sensor = sensorCount;
+		sock.fd = socket(AF_INET, SOCK_DGRAM, 0);
+		if (sock.fd < 0)
+		{
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "socket: %s", strerror(errno));
+			return false;
+		}
+		sockets.push_back(sock);
+
+		setsockopt(sock.fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		if (setsockopt(sock.fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvBufBytes, sizeof(rcvBufBytes)) < 0)
+			setsockopt(sock.fd, SOL_SOCKET, SO_RCVBUF, &rcvBufBytes, sizeof(rcvBufBytes));
+		if (setsockopt(sock.fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0)
+		{
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "SO_TIMESTAMPNS on port %u: %s", sock.port, strerror(errno));
+			return false;
+		}
+
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.sin_port = htons(sock.port);
+		if (bind(sock.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		{
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "bind to UDP port %u: %s", sock.port, strerror(errno));
+			return false;
+		}
+	}
+
+	sensorCount++;
+	return true;
+}
+
+int UringCapture::Run(PacketHandler handler, void *user, char *errbuf, const std::atomic<bool> *stop)
+{
+	RawPacket packet;
+	struct __kernel_timespec timeout;
+	struct io_uring_getevents_arg wait;
+
+	packet.layer = LAYER_UDP_PAYLOAD;
+	/*only the lengths are read by the kernel: no source address, room for the timestamp*/
+	memset(&recvHeader, 0, sizeof(recvHeader));
+	recvHeader.msg_controllen = URING_CONTROL_SIZE;
+	for (unsigned int s = 0; s < sockets.size(); s++)
+		ArmRecv(s);
+
+	/*the wait for completions times out so the stop flag is seen without any datagram coming in*/
+	memset(&wait, 0, sizeof(wait));
+	timeout.tv_sec = 0;
+	timeout.tv_nsec = CAPTURE_STOP_CHECK_MS * 1000000LL;
+	wait.ts = (uint64_t)(uintptr_t)&timeout;
+
+	for (;;)
+	{
+		if (stop != NULL && stop->load(std::memory_order_relaxed))
+			return 0;
+		int ret = (int)syscall(__NR_io_uring_enter, ringFd, toSubmit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			&wait, sizeof(wait));
+		if (ret < 0)
+		{
+			if (errno == EINTR || errno == ETIME)
+				continue;
+			snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "io_uring_enter: %s", strerror(errno));
+			return -1;
+		}
+		toSubmit -= ret;
+		enters++;
+
+		/*only for a datagram that came without its kernel timestamp*/
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		uint64_t reapedNs = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+		unsigned int head = *cqHead;
+		unsigned int tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++)
+		{
+			struct io_uring_cqe *cqe = &cqes[head & *cqMask];
+			unsigned int s = (unsigned int)cqe->user_data;
+
+			if (cqe->flags & IORING_CQE_F_BUFFER)
+			{
+				unsigned int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+				if (cqe->res > 0)
+				{
+					/*the buffer holds the recvmsg header, the address (none asked for), the control messages and
+					then the payload, at the offsets given by the lengths of recvHeader*/
+					unsigned char *buffer = buffers + (size_t)bid * URING_BUFFER_SIZE;
+					struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buffer;
+					unsigned char *control = buffer + sizeof(*out) + recvHeader.msg_namelen;
+					unsigned int offset = (unsigned int)(sizeof(*out) + recvHeader.msg_namelen + recvHeader.msg_controllen);
+					unsigned int stored = ((unsigned int)cqe->res > offset) ? (unsigned int)cqe->res - offset : 0;
+
+					packet.timestampNs = ReceiveTime(control, out->controllen, reapedNs);
+					packet.data = buffer + offset;
+					packet.caplen = (out->payloadlen < stored) ? out->payloadlen : stored;
+					packet.len = out->payloadlen;
+					packet.dstPort = sockets[s].port;
+					packet.sensor = sockets[s].sensor;
+					handler(packet, user);
+					datagrams++;
+				}
+				RecycleBuffer(bid);
+			}
+			else if (cqe->res < 0 && cqe->res != -ENOBUFS)
+			{
+				snprintf(errbuf, CAPTURE_ERRBUF_SIZE, "recv on UDP port %u: %s", sockets[s].port, strerror(-cqe->res));
+				__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+				return -1;
+			}
+
+			/*the multishot request stops when it runs out of buffers or hits an error, start a new one*/
+			if ((cqe->flags & IORING_CQE_F_MORE) == 0)
+			{
+				ArmRecv(s);
+				rearms++;
+			}
+		}
+		__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+		PublishBuffers();
+	}
+}
+
+uint64_t UringCapture::ReceiveTime(unsigned char *control, unsigned int controlLen, uint64_t fallbackNs)
+{
+	struct msghdr hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_control = control;
+	hdr.msg_controllen = controlLen;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+	{
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+		{
+			struct timespec ts;
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		}
+	}
+	unstamped++;
+	return fallbackNs;
+}
+
+void UringCapture::ArmRecv(unsigned int s)
+{
+	unsigned int tail = *sqTail;
+	unsigned int index = tail & *sqMask;
+	struct io_uring_sqe *sqe = &sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = sockets[s].fd;
+	sqe->addr = (uint64_t)(uintptr_t)&recvHeader;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUFFER_GROUP;
+	sqe->user_data = s;
+	sqArray[index] = index;
+	__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+	toSubmit++;
+}
+
+void UringCapture::RecycleBuffer(unsigned int bid)
+{
+	/*not bufRing->bufs: the uapi header declares it through __DECLARE_FLEX_ARRAY, which puts a one byte empty
+	struct in front of the array when compiled as C++ and shifts it by eight bytes*/
+	struct io_uring_buf *buf = (struct io_uring_buf *)bufRing + (bufTail & (URING_BUFFER_COUNT - 1));
+
+	buf->addr = (uint64_t)(uintptr_t)(buffers + (size_t)bid * URING_BUFFER_SIZE);
+	buf->len = URING_BUFFER_SIZE;
+	buf->bid = (unsigned short)bid;
+	bufTail++;
+}
+
+void UringCapture::PublishBuffers()
+{
+	__atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+}
+
+void UringCapture::PrintStats(FILE *out)
+{
+	fprintf(out, "io_uring: %llu datagrams from %u sensors in %llu io_uring_enter calls (%.1f per call), %llu re-armed receives, "
+		"%llu without a kernel timestamp\n", (unsigned long long)datagrams, sensorCount, (unsigned long long)enters,
+		enters ? (double)datagrams / enters : 0.0, (unsigned long long)rearms, (unsigned long long)unstamped);
+}
+
+void UringCapture::Close()
+{
+	for (unsigned int s = 0; s < sockets.size(); s++)
+		close(sockets[s].fd);
+	sockets.clear();
+	sensorCount = 0;
+
+	/*closing the ring also drops the buffer registration*/
+	if (ringFd >= 0)
+	{
+		close(ringFd);
+		ringFd = -1;
+	}
+	if (bufRing != NULL)
+	{
+		munmap(bufRing, bufRingSize);
+		bufRing = NULL;
+	}
+	delete[] buffers;
+	buffers = NULL;
+	if (sqes != NULL)
+	{
+		munmap(sqes, sqesSize);
+		sqes = NULL;
+	}
+	if (cqRing != NULL && cqRing != sqRing)
+		munmap(cqRing, cqRingSize);
+	cqRing = NULL;
+	if (sqRing != NULL)
+	{
+		munmap(sqRing, sqRingSize);
+		sqRing = NULL;
+	}
+	toSubmit = 0;
+}
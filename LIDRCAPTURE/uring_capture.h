@@ -0,0 +1,90 @@
+#ifndef URING_CAPTURE_H
+#define URING_CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <sys/socket.h>
+#include "capture.h"
+
+/*number of receive buffers shared by all sockets through the provided buffer ring (power of two)*/
+#define URING_BUFFER_COUNT 1024
+/*size of one receive buffer, larger than any packet the sensor sends*/
+#define URING_BUFFER_SIZE 2048
+
+struct io_uring_buf_ring;
+
+/*Capture backend that services the UDP sockets of any number of sensors from one thread with io_uring.
+Every socket gets a single multishot recvmsg request that keeps producing completions, and the kernel picks the
+receive buffer for each datagram from a ring of buffers we provide, so steady state capture makes no syscall per
+packet: one io_uring_enter waits for and returns a whole batch of datagrams from all sensors. each buffer also gets
+the SO_TIMESTAMPNS control message of its datagram, so packets carry the kernel receive time like with recvmmsg.
+Talks to the kernel through the raw syscalls so liburing is not needed; needs Linux 6.0 or newer.*/
+class UringCapture
+{
+public:
+	UringCapture();
+	~UringCapture();
+
+	/*sets up the ring and the provided buffers. returns false and fills errbuf (CAPTURE_ERRBUF_SIZE bytes) on failure.*/
+	bool Open(char *errbuf);
+	/*binds the data and position sockets of one more sensor. packets from it are tagged with the index of the call
+	(0 for the first sensor). returns false and fills errbuf on failure.*/
+	bool AddSensor(unsigned short dataPort, unsigned short positionPort, char *errbuf, int rcvBufBytes = 32 << 20);
+	/*receives datagrams from all sensors and calls handler for every one of them. returns 0 once stop is set (checked
+	at least every CAPTURE_STOP_CHECK_MS) and -1 on error, with errbuf filled in.*/
+	int Run(PacketHandler handler, void *user, char *errbuf, const std::atomic<bool> *stop = NULL);
+	/*prints datagram and io_uring_enter counters*/
+	void PrintStats(FILE *out);
+	void Close();
+
+private:
+	/*one bound socket*/
+	struct Socket
+	{
+		int fd;
+		unsigned short port;
+		unsigned int sensor;
+	};
+
+	/*queues a multishot recvmsg on socket s; it is submitted with the next io_uring_enter*/
+	void ArmRecv(unsigned int s);
+	/*the kernel timestamp among the control messages of a received buffer, fallbackNs if there is none*/
+	uint64_t ReceiveTime(unsigned char *control, unsigned int controlLen, uint64_t fallbackNs);
+	/*hands buffer bid back to the kernel; made visible by PublishBuffers*/
+	void RecycleBuffer(unsigned int bid);
+	void PublishBuffers();
+
+	int ringFd;
+	std::vector<Socket> sockets;
+	unsigned int sensorCount;
+
+	/*submission queue*/
+	void *sqRing;
+	size_t sqRingSize;
+	unsigned int *sqHead, *sqTail, *sqMask, *sqArray;
+	struct io_uring_sqe *sqes;
+	size_t sqesSize;
+	unsigned int toSubmit;
+
+	/*completion queue, shares the mapping with the submission queue on kernels with IORING_FEAT_SINGLE_MMAP*/
+	void *cqRing;
+	size_t cqRingSize;
+	unsigned int *cqHead, *cqTail, *cqMask;
+	struct io_uring_cqe *cqes;
+
+	/*provided buffers*/
+	struct io_uring_buf_ring *bufRing;
+	size_t bufRingSize;
+	unsigned char *buffers;
+	unsigned short bufTail;
+	/*the lengths of the address and control data every recvmsg asks for, read by the kernel when it is armed*/
+	struct msghdr recvHeader;
+
+	uint64_t datagrams;
+	uint64_t enters;
+	uint64_t rearms;	//multishot requests that ended (for example when every buffer was in use) and were re-armed
+	uint64_t unstamped;	//datagrams stamped with the time their batch was reaped instead
+};
+
+#endif